@@ -0,0 +1,438 @@
+/*
+ * Copyright 2020 Xinyue Lu
+ *
+ * MiniDeen - command line filter for YUV4MPEG2 streams and raw files.
+ *
+ */
+
+#include "libminideen.h"
+#include "mapped_file.h"
+#include <chrono>
+#include <condition_variable>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+struct Format {
+  int width {0}, height {0};
+  int ssw {1}, ssh {1};
+  int bits {8};
+  int planes {3};
+
+  int bytes() const { return bits > 8 ? 2 : 1; }
+  int plane_width(int p) const { return p ? (width + ssw) >> ssw : width; }
+  int plane_height(int p) const { return p ? (height + ssh) >> ssh : height; }
+  size_t plane_size(int p) const { return static_cast<size_t>(plane_width(p)) * plane_height(p) * bytes(); }
+  size_t frame_size() const {
+    size_t size = 0;
+    for (int p = 0; p < planes; p++)
+      size += plane_size(p);
+    return size;
+  }
+};
+
+struct Frame {
+  int index;
+  std::string header;
+  std::vector<uint8_t> data;
+};
+
+// Frames handed from one stage to the next, in any order.
+class FrameQueue {
+public:
+  void push(Frame &&frame) {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      frames.push_back(std::move(frame));
+    }
+    ready.notify_one();
+  }
+  // False once the queue is closed and drained.
+  bool pop(Frame &frame) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [&] { return closed || !frames.empty(); });
+    if (frames.empty())
+      return false;
+    frame = std::move(frames.front());
+    frames.pop_front();
+    return true;
+  }
+  void close() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Frame> frames;
+  bool closed {false};
+};
+
+static bool read_line(FILE *file, std::string &line) {
+  line.clear();
+  for (int c; (c = fgetc(file)) != EOF;) {
+    if (c == '\n')
+      return true;
+    line += static_cast<char>(c);
+  }
+  return !line.empty();
+}
+
+// A Y4M colorspace tag: 420jpeg, 422, 444p10, mono16 and the like.
+// Digits only, as in the depth of mono16 or 420p10; -1 otherwise.
+static int parse_depth(const std::string &digits) {
+  if (digits.empty() || digits.size() > 2 || !std::all_of(digits.begin(), digits.end(), [](unsigned char c) { return isdigit(c); }))
+    return -1;
+  return std::atoi(digits.c_str());
+}
+
+static void parse_colorspace(Format &format, const std::string &cs) {
+  std::string suffix = cs.size() > 4 ? cs.substr(4) : "";
+  if (cs.compare(0, 4, "mono") == 0) {
+    format.planes = 1;
+    format.ssw = format.ssh = 0;
+    format.bits = suffix.empty() ? 8 : parse_depth(suffix);
+    if (format.bits < 0)
+      throw std::runtime_error("unsupported colorspace " + cs + ".");
+    return;
+  }
+  format.planes = 3;
+  std::string family = cs.substr(0, 3);
+  suffix = cs.size() > 3 ? cs.substr(3) : "";
+  if (family == "420")
+    format.ssw = format.ssh = 1;
+  else if (family == "422")
+    format.ssw = 1, format.ssh = 0;
+  else if (family == "444")
+    format.ssw = format.ssh = 0;
+  else
+    throw std::runtime_error("unsupported colorspace " + cs + ".");
+  // 420jpeg, 420mpeg2 and 420paldv only differ in chroma siting. Anything
+  // else, such as the extra plane of 444alpha, is refused.
+  format.bits = 8;
+  if (suffix[0] == 'p')
+    format.bits = parse_depth(suffix.substr(1));
+  else if (!suffix.empty() && !(family == "420" && (suffix == "jpeg" || suffix == "mpeg2" || suffix == "paldv")))
+    format.bits = -1;
+  if (format.bits < 0)
+    throw std::runtime_error("unsupported colorspace " + cs + ".");
+}
+
+static void check_format(const Format &format) {
+  if (format.width <= 0 || format.height <= 0)
+    throw std::runtime_error("missing frame size.");
+  if (format.bits < 8 || format.bits > 16)
+    throw std::runtime_error("only 8..16 bit input is supported.");
+}
+
+static Format parse_header(const std::string &header) {
+  if (header.compare(0, 10, "YUV4MPEG2 ") != 0)
+    throw std::runtime_error("input is not YUV4MPEG2.");
+  Format format;
+  size_t pos = 9;
+  while (pos < header.size()) {
+    size_t end = header.find(' ', pos + 1);
+    std::string token = header.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+    pos = end == std::string::npos ? header.size() : end;
+    if (token.empty())
+      continue;
+    if (token[0] == 'W')
+      format.width = std::atoi(token.c_str() + 1);
+    else if (token[0] == 'H')
+      format.height = std::atoi(token.c_str() + 1);
+    else if (token[0] == 'C')
+      parse_colorspace(format, token.substr(1));
+  }
+  check_format(format);
+  return format;
+}
+
+// Filter one tightly packed frame, plane after plane.
+static void filter_frame(minideen_context *const contexts[2], const Format &format, const uint8_t *src, uint8_t *dst) {
+  size_t offset = 0;
+  for (int p = 0; p < format.planes; p++) {
+    int row_bytes = format.plane_width(p) * format.bytes();
+    minideen_process_plane(contexts[p ? 1 : 0], src + offset, row_bytes, dst + offset, row_bytes, format.plane_width(p), format.plane_height(p));
+    offset += format.plane_size(p);
+  }
+}
+
+static bool create_contexts(minideen_context *contexts[2], const Format &format, int radius, int threshold, int threshold_uv, int opt) {
+  const char *error = nullptr;
+  minideen_params luma_params {format.bits, radius, threshold, opt};
+  minideen_params chroma_params {format.bits, radius, threshold_uv, opt};
+  contexts[0] = minideen_create(&luma_params, &error);
+  contexts[1] = minideen_create(&chroma_params, &error);
+  if (contexts[0] && contexts[1])
+    return true;
+  fprintf(stderr, "minideen-cli: %s\n", error);
+  minideen_free(contexts[0]);
+  minideen_free(contexts[1]);
+  return false;
+}
+
+static void report(int frames, std::chrono::steady_clock::time_point start) {
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "minideen-cli: %d frames in %.2f s, %.2f fps\n", frames, seconds, seconds > 0 ? frames / seconds : 0.0);
+}
+
+// Raw planar files are mapped whole and the planes handed to libminideen
+// where they lie, without reading frames through stdio. Every worker takes
+// its own contiguous range of frames.
+static int run_raw(const char *input, const char *output, const Format &format, minideen_context *const contexts[2], int threads) {
+  auto start = std::chrono::steady_clock::now();
+  int frames = 0;
+  try {
+    MappedFile in(input);
+    size_t frame_size = format.frame_size();
+    if (in.size() % frame_size != 0)
+      throw std::runtime_error("input size is not a whole number of frames.");
+    // Creating the output truncates it, which would empty the input.
+    if (in.same_file(output))
+      throw std::runtime_error("output is the input file.");
+    frames = static_cast<int>(in.size() / frame_size);
+    MappedFile out(output, in.size());
+    in.advise_sequential();
+    out.advise_sequential();
+
+    threads = std::min(threads, std::max(frames, 1));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+      workers.emplace_back([&, t] {
+        int first = static_cast<int>(static_cast<int64_t>(frames) * t / threads);
+        int last = static_cast<int>(static_cast<int64_t>(frames) * (t + 1) / threads);
+        for (int n = first; n < last; n++)
+          filter_frame(contexts, format, in.data() + n * frame_size, out.data() + n * frame_size);
+      });
+    for (auto &&worker : workers)
+      worker.join();
+  }
+  catch (const std::exception &e) {
+    fprintf(stderr, "minideen-cli: %s\n", e.what());
+    return 1;
+  }
+  report(frames, start);
+  return 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "Usage: minideen-cli [options] [input.y4m | -] > output.y4m\n"
+    "       minideen-cli [options] --raw WxH [--format CS] input.yuv -o output.yuv\n"
+    "  -r, --radius N        radius, 1..7 (default 1)\n"
+    "  -t, --threshold N     luma threshold, 0..255 (default 10)\n"
+    "  -u, --threshold-uv N  chroma threshold, 0..255 (default 12)\n"
+    "  -j, --threads N       filter threads, 0 for every core (default 0)\n"
+    "      --opt N           0 auto, 1 C, 2 SSE2, 3 AVX2 (default 0)\n"
+    "      --raw WxH         memory-map headerless planar input of this size\n"
+    "      --format CS       raw colorspace as a Y4M C tag, e.g. 420p10 (default 420)\n"
+    "  -o, --output FILE     raw output, preallocated and memory-mapped\n");
+}
+
+int main(int argc, char **argv) {
+  int radius = 1, threshold = 10, threshold_uv = 12, threads = 0, opt = 0;
+  const char *input = "-";
+  const char *output = nullptr;
+  const char *raw_size = nullptr;
+  std::string colorspace = "420";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto text = [&]() {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    auto value = [&]() { return std::atoi(text()); };
+    if (arg == "-r" || arg == "--radius")
+      radius = value();
+    else if (arg == "-t" || arg == "--threshold")
+      threshold = value();
+    else if (arg == "-u" || arg == "--threshold-uv")
+      threshold_uv = value();
+    else if (arg == "-j" || arg == "--threads")
+      threads = value();
+    else if (arg == "--opt")
+      opt = value();
+    else if (arg == "--raw")
+      raw_size = text();
+    else if (arg == "--format")
+      colorspace = text();
+    else if (arg == "-o" || arg == "--output")
+      output = text();
+    else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    }
+    else if (arg[0] == '-' && arg != "-") {
+      usage();
+      return 2;
+    }
+    else
+      input = argv[i];
+  }
+  if (threads <= 0)
+    threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+  if (raw_size) {
+    Format format;
+    try {
+      if (sscanf(raw_size, "%dx%d", &format.width, &format.height) != 2)
+        throw std::runtime_error("--raw takes WIDTHxHEIGHT.");
+      parse_colorspace(format, colorspace);
+      check_format(format);
+      if (!output || strcmp(input, "-") == 0)
+        throw std::runtime_error("--raw needs an input file and -o.");
+    }
+    catch (const std::exception &e) {
+      fprintf(stderr, "minideen-cli: %s\n", e.what());
+      return 1;
+    }
+    minideen_context *contexts[2];
+    if (!create_contexts(contexts, format, radius, threshold, threshold_uv, opt))
+      return 1;
+    int result = run_raw(input, output, format, contexts, threads);
+    minideen_free(contexts[0]);
+    minideen_free(contexts[1]);
+    return result;
+  }
+  if (output) {
+    usage();
+    return 2;
+  }
+
+#ifdef _WIN32
+  // Frames are binary; text mode would expand 0x0A on output and stop
+  // reading at 0x1A.
+  _setmode(_fileno(stdin), _O_BINARY);
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  FILE *in = strcmp(input, "-") == 0 ? stdin : fopen(input, "rb");
+  if (!in) {
+    fprintf(stderr, "minideen-cli: cannot open %s.\n", input);
+    return 1;
+  }
+
+  std::string stream_header;
+  Format format;
+  try {
+    if (!read_line(in, stream_header))
+      throw std::runtime_error("empty input.");
+    format = parse_header(stream_header);
+  }
+  catch (const std::exception &e) {
+    fprintf(stderr, "minideen-cli: %s\n", e.what());
+    return 1;
+  }
+
+  minideen_context *contexts[2];
+  if (!create_contexts(contexts, format, radius, threshold, threshold_uv, opt))
+    return 1;
+
+  fwrite(stream_header.data(), 1, stream_header.size(), stdout);
+  fputc('\n', stdout);
+
+  // Read -> filter on N threads -> write in order. At most in_flight frames
+  // are between reading and writing, which bounds both queues and the
+  // reorder buffer.
+  const int in_flight = threads * 2;
+  FrameQueue to_filter, to_write;
+  std::mutex flight_mutex;
+  std::condition_variable flight_done;
+  int flying = 0;
+  bool read_failed = false;
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread reader([&] {
+    std::string header;
+    for (int index = 0; read_line(in, header); index++) {
+      if (header.compare(0, 5, "FRAME") != 0) {
+        read_failed = true;
+        break;
+      }
+      {
+        std::unique_lock<std::mutex> lock(flight_mutex);
+        flight_done.wait(lock, [&] { return flying < in_flight; });
+        flying++;
+      }
+      Frame frame {index, header, std::vector<uint8_t>(format.frame_size())};
+      if (fread(frame.data.data(), 1, frame.data.size(), in) != frame.data.size()) {
+        read_failed = true;
+        break;
+      }
+      to_filter.push(std::move(frame));
+    }
+    to_filter.close();
+  });
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++)
+    workers.emplace_back([&] {
+      Frame frame;
+      std::vector<uint8_t> out;
+      while (to_filter.pop(frame)) {
+        out.resize(frame.data.size());
+        filter_frame(contexts, format, frame.data.data(), out.data());
+        std::swap(frame.data, out);
+        to_write.push(std::move(frame));
+      }
+    });
+
+  std::thread closer([&] {
+    for (auto &&worker : workers)
+      worker.join();
+    to_write.close();
+  });
+
+  std::map<int, Frame> pending;
+  int next = 0;
+  Frame frame;
+  while (to_write.pop(frame)) {
+    pending.emplace(frame.index, std::move(frame));
+    for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+      fwrite(it->second.header.data(), 1, it->second.header.size(), stdout);
+      fputc('\n', stdout);
+      fwrite(it->second.data.data(), 1, it->second.data.size(), stdout);
+      pending.erase(it);
+      {
+        std::lock_guard<std::mutex> guard(flight_mutex);
+        flying--;
+      }
+      flight_done.notify_one();
+    }
+  }
+
+  reader.join();
+  closer.join();
+  fflush(stdout);
+  if (in != stdin)
+    fclose(in);
+  minideen_free(contexts[0]);
+  minideen_free(contexts[1]);
+
+  report(next, start);
+  if (read_failed) {
+    fprintf(stderr, "minideen-cli: input ended inside a frame or is not YUV4MPEG2.\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include "mapped_file.h"
+#include <stdexcept>
+
+// Constructors release what they opened before throwing, as the destructor
+// does not run then.
+void MappedFile::fail(const char *message) {
+  release();
+  throw std::runtime_error(message);
+}
+
+#ifdef _WIN32
+#include <windows.h>
+
+MappedFile::MappedFile(const char *path) {
+  _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (_file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("cannot open input.");
+  LARGE_INTEGER size;
+  GetFileSizeEx(_file, &size);
+  _size = static_cast<size_t>(size.QuadPart);
+  if (_size == 0)
+    return;
+  _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (_mapping)
+    _data = static_cast<uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!_data)
+    fail("cannot map input.");
+}
+
+MappedFile::MappedFile(const char *path, size_t size) : _size(size) {
+  _file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+  if (_file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("cannot create output.");
+  if (_size == 0)
+    return;
+  LARGE_INTEGER high {};
+  high.QuadPart = static_cast<LONGLONG>(size);
+  _mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, high.HighPart, high.LowPart, nullptr);
+  if (_mapping)
+    _data = static_cast<uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, 0));
+  if (!_data)
+    fail("cannot map output.");
+}
+
+MappedFile::~MappedFile() {
+  release();
+}
+
+void MappedFile::release() {
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle(_mapping);
+  if (_file && _file != INVALID_HANDLE_VALUE)
+    CloseHandle(_file);
+  _data = nullptr;
+  _mapping = _file = nullptr;
+}
+
+// FILE_FLAG_SEQUENTIAL_SCAN at open time covers it.
+void MappedFile::advise_sequential() {}
+
+bool MappedFile::same_file(const char *path) const {
+  HANDLE other = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+  if (other == INVALID_HANDLE_VALUE)
+    return false;
+  BY_HANDLE_FILE_INFORMATION a, b;
+  bool same = GetFileInformationByHandle(_file, &a) && GetFileInformationByHandle(other, &b) &&
+    a.dwVolumeSerialNumber == b.dwVolumeSerialNumber && a.nFileIndexHigh == b.nFileIndexHigh && a.nFileIndexLow == b.nFileIndexLow;
+  CloseHandle(other);
+  return same;
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const char *path) {
+  _fd = open(path, O_RDONLY);
+  if (_fd < 0)
+    throw std::runtime_error("cannot open input.");
+  struct stat st;
+  if (fstat(_fd, &st) != 0)
+    fail("cannot open input.");
+  _size = static_cast<size_t>(st.st_size);
+  if (_size == 0)
+    return;
+  void *p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+  if (p == MAP_FAILED)
+    fail("cannot map input.");
+  _data = static_cast<uint8_t *>(p);
+}
+
+MappedFile::MappedFile(const char *path, size_t size) : _size(size) {
+  _fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (_fd < 0)
+    throw std::runtime_error("cannot create output.");
+  if (_size == 0)
+    return;
+  if (ftruncate(_fd, static_cast<off_t>(_size)) != 0)
+    fail("cannot size output.");
+  void *p = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (p == MAP_FAILED)
+    fail("cannot map output.");
+  _data = static_cast<uint8_t *>(p);
+}
+
+MappedFile::~MappedFile() {
+  release();
+}
+
+void MappedFile::release() {
+  if (_data)
+    munmap(_data, _size);
+  if (_fd >= 0)
+    close(_fd);
+  _data = nullptr;
+  _fd = -1;
+}
+
+void MappedFile::advise_sequential() {
+  if (_data)
+    madvise(_data, _size, MADV_SEQUENTIAL);
+}
+
+bool MappedFile::same_file(const char *path) const {
+  struct stat a, b;
+  return fstat(_fd, &a) == 0 && stat(path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A whole file mapped into memory, read-only or as a preallocated output of
+// a given size. Throws std::runtime_error on failure.
+class MappedFile {
+public:
+  MappedFile(const char *path);
+  MappedFile(const char *path, size_t size);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  uint8_t *data() const { return _data; }
+  size_t size() const { return _size; }
+
+  // Tell the kernel the mapping is read front to back, so pages are read
+  // ahead and dropped behind.
+  void advise_sequential();
+
+  // Whether path names this file, through links or another spelling too.
+  bool same_file(const char *path) const;
+
+private:
+  void release();
+  [[noreturn]] void fail(const char *message);
+
+  uint8_t *_data {nullptr};
+  size_t _size {0};
+#ifdef _WIN32
+  void *_file {nullptr}, *_mapping {nullptr};
+#else
+  int _fd {-1};
+#endif
+};
@@ -114,14 +114,16 @@ namespace AVSInterface
   struct AVSFetchFrameFunctor final : FetchFrameFunctor {
     PClip _clip;
     VideoInfo _vi;
-    IScriptEnvironment* _env;
-    std::mutex fetch_frame_mutex;
-    AVSFetchFrameFunctor(PClip clip, VideoInfo vi, IScriptEnvironment * env)
-      : _clip(clip), _vi(vi), _env(env) {}
-    DSFrame operator()(int n) override {
-      std::lock_guard<std::mutex> guard(fetch_frame_mutex);
-      auto frame = _clip->GetFrame(n, _env);
-      return DSFrame(frame, _vi, _env);
+    bool _has_v8;
+    AVSFetchFrameFunctor(PClip clip, VideoInfo vi, bool has_v8)
+      : _clip(clip), _vi(vi), _has_v8(has_v8) {}
+    // Under MT every call has its own env, so there is nothing to share
+    // between threads and no lock.
+    DSFrame operator()(int n, const DSFrameSet &in_frames) override {
+      if (!in_frames.AVSEnv)
+        throw "fetch_frame needs the frame set of the current call.";
+      auto frame = _clip->GetFrame(n, in_frames.AVSEnv);
+      return DSFrame(frame, _vi, in_frames.AVSEnv, _has_v8);
     }
     ~AVSFetchFrameFunctor() override {}
   };
@@ -135,33 +137,176 @@ namespace AVSInterface
     PClip clip;
     VideoInfo vi;
     AVSFetchFrameFunctor* functor {nullptr};
+    bool has_v8 {false};
+    // Lookahead for serial hosts. The host thread fetches the input frames
+    // of the frames after the last one served and allocates their output,
+    // so neither the env nor the filters upstream are used off it. One
+    // background thread filters them in order, and a seek drops them.
+    struct PrefetchJob {
+      DSFrameSet in_frames;
+      DSFrameAhead ahead;
+    };
+    std::thread prefetch_thread;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_wake, prefetch_done;
+    std::map<int, std::unique_ptr<PrefetchJob>> prefetch_jobs;
+    std::map<int, PVideoFrame> prefetched;
+    // Next frame to prepare, the one being filtered, and a count of seeks
+    // that tells a frame finished after a seek to be dropped.
+    int prefetch_next {0}, prefetch_busy {-1};
+    unsigned prefetch_seeks {0};
+    bool prefetch_stop {false};
+    // -1 until the first request tells whether the host is serial.
+    std::atomic<int> serial_host {-1};
     
     AVSWrapper(AVSValue args, IScriptEnvironment* env)
       : _args(args), _env(env) {}
     
     void Initialize()
     {
+      // Probed once here, as CheckVersion throws on older hosts.
+      try { _env->CheckVersion(8); has_v8 = true; }
+      catch (const AvisynthError&) { has_v8 = false; }
+
       auto input_vi = DSVideoInfo();
       if (_args[0].IsClip()) {
         clip = _args[0].AsClip();
         input_vi = DSVideoInfo(clip->GetVideoInfo());
-        functor = new AVSFetchFrameFunctor(clip, clip->GetVideoInfo(), _env);
+        functor = new AVSFetchFrameFunctor(clip, clip->GetVideoInfo(), has_v8);
       }
       auto argument = AVSInDelegator(_args, data.Params());
       data.Initialize(&argument, input_vi, functor);
+      // Ask the input cache to keep only the frames the filter reads.
+      if (clip)
+        clip->SetCacheHints(CACHE_WINDOW, data.AVSCacheWindow() * 2 + 1);
+    }
+
+    // Prefetch only pays off when the host calls GetFrame from one thread,
+    // which then has time to spare while its frames are filtered. That is
+    // known from the first request, as Prefetch() in a script comes after
+    // the filters are made. Hosts before v8 cannot tell and are taken as
+    // serial.
+    bool Prefetching(IScriptEnvironment * env) {
+      if (data.AVSPrefetch() <= 0)
+        return false;
+      int serial = serial_host.load();
+      if (serial < 0) {
+        serial = !has_v8 || env->GetEnvProperty(AEP_FILTERCHAIN_THREADS) <= 1;
+        serial_host = serial;
+      }
+      return serial;
     }
 
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment * env) override {
-      std::unordered_map<int, DSFrame> in_frames;
+      if (!Prefetching(env) || !functor)
+        return Compute(n, env);
+
+      PVideoFrame frame;
+      std::unique_ptr<PrefetchJob> job;
+      {
+        std::unique_lock<std::mutex> lock(prefetch_mutex);
+        // Frame n may be on its way; waiting beats filtering it twice.
+        prefetch_done.wait(lock, [&] { return prefetch_busy != n; });
+        auto hit = prefetched.find(n);
+        auto queued = prefetch_jobs.find(n);
+        if (hit != prefetched.end())
+          frame = hit->second;
+        else if (queued != prefetch_jobs.end())
+          // Prepared but not reached by the background thread yet.
+          job = std::move(queued->second);
+        else {
+          // A seek. The frame in flight is dropped when it lands, without
+          // waiting for it here.
+          prefetch_seeks++;
+          prefetched.clear();
+          prefetch_jobs.clear();
+          prefetch_next = n + 1;
+        }
+        prefetched.erase(prefetched.begin(), prefetched.upper_bound(n));
+        prefetch_jobs.erase(prefetch_jobs.begin(), prefetch_jobs.upper_bound(n));
+        prefetch_next = std::max(prefetch_next, n + 1);
+      }
+      if (job)
+        frame = data.GetFrame(n, job->in_frames).ToAVSFrame();
+      else if (!frame)
+        frame = Compute(n, env);
+
+      // Top the lookahead up from here, on the host thread.
+      int end = std::min(n + 1 + data.AVSPrefetch(), data.GetOutputVI().Frames);
+      for (int next = prefetch_next; next < end; next++) {
+        // Errors are left for the host's own request of the frame to report.
+        try { job = Prepare(next, env); }
+        catch (...) { break; }
+        std::lock_guard<std::mutex> guard(prefetch_mutex);
+        prefetch_jobs[next] = std::move(job);
+        prefetch_next = next + 1;
+        if (!prefetch_thread.joinable())
+          prefetch_thread = std::thread([this] { Prefetch(); });
+        prefetch_wake.notify_one();
+      }
+      return frame;
+    }
+
+    // Output frame for a frame filtered ahead.
+    virtual PVideoFrame NewFrameAhead(const VideoInfo & out_vi, PVideoFrame * props, IScriptEnvironment * env) {
+      return has_v8 && props ? env->NewVideoFrameP(out_vi, props) : env->NewVideoFrame(out_vi);
+    }
+
+    // Everything frame n needs from the host. The frames carry no env, so
+    // filtering them cannot reach it.
+    std::unique_ptr<PrefetchJob> Prepare(int n, IScriptEnvironment * env) {
+      auto job = std::make_unique<PrefetchJob>();
+      auto requests = data.RequestReferenceFrames(n);
+      PVideoFrame props;
+      for (auto &&i : requests) {
+        auto frame = clip->GetFrame(i, env);
+        if (i == n)
+          props = frame;
+        job->in_frames.Add(i, DSFrame(frame, functor->_vi, nullptr, has_v8));
+      }
+      job->ahead.VI = data.GetOutputVI().ToAVSVI();
+      job->ahead.Frame = NewFrameAhead(job->ahead.VI, props ? &props : nullptr, env);
+      for (int i = 0; i < job->in_frames.Count; i++)
+        job->in_frames.Frames[i]._avs_ahead = &job->ahead;
+      return job;
+    }
+
+    void Prefetch() {
+      std::unique_lock<std::mutex> lock(prefetch_mutex);
+      for (;;) {
+        prefetch_wake.wait(lock, [&] { return prefetch_stop || !prefetch_jobs.empty(); });
+        if (prefetch_stop)
+          return;
+        int n = prefetch_jobs.begin()->first;
+        auto job = std::move(prefetch_jobs.begin()->second);
+        prefetch_jobs.erase(prefetch_jobs.begin());
+        unsigned seeks = prefetch_seeks;
+        prefetch_busy = n;
+        lock.unlock();
+        PVideoFrame frame;
+        try { frame = data.GetFrame(n, job->in_frames).ToAVSFrame(); }
+        catch (...) {}
+        job.reset();
+        lock.lock();
+        if (frame && seeks == prefetch_seeks)
+          prefetched[n] = frame;
+        prefetch_busy = -1;
+        prefetch_done.notify_all();
+      }
+    }
+
+    PVideoFrame Compute(int n, IScriptEnvironment * env) {
+      DSFrameSet in_frames;
+      in_frames.AVSEnv = env;
       if (functor) {
-        std::vector<int> requests = data.RequestReferenceFrames(n);
+        auto requests = data.RequestReferenceFrames(n);
         for (auto &&i : requests) {
           auto frame = clip->GetFrame(i, env);
-          in_frames[i] = DSFrame(frame, vi, env);
+          in_frames.Add(i, DSFrame(frame, functor->_vi, env, has_v8));
         }
       }
       else
-        in_frames[n] = DSFrame(env);
+        in_frames.Add(n, DSFrame(env, has_v8));
       
       return data.GetFrame(n, in_frames).ToAVSFrame();
     }
@@ -176,6 +321,15 @@ namespace AVSInterface
     bool __stdcall GetParity(int n) override { return clip ? clip->GetParity(n) : false; }
     int __stdcall SetCacheHints(int cachehints, int frame_range) override { return data.SetCacheHints(cachehints, frame_range); }
     ~AVSWrapper() {
+      {
+        std::lock_guard<std::mutex> guard(prefetch_mutex);
+        prefetch_stop = true;
+      }
+      prefetch_wake.notify_all();
+      if (prefetch_thread.joinable())
+        prefetch_thread.join();
+      prefetch_jobs.clear();
+      prefetched.clear();
       delete functor;
     }
   };
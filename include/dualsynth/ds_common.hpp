@@ -7,20 +7,41 @@
 #pragma once
 
 #include <avisynth.h>
+// VapourSynth API 4 when the build defines DS_VAPOURSYNTH_API4, API 3
+// otherwise. API 3 names are aliased to it below.
+#ifdef DS_VAPOURSYNTH_API4
+#include <VapourSynth4.h>
+typedef VSFrame VSFrameRef;
+typedef VSNode VSNodeRef;
+typedef VSVideoFormat VSFormat;
+static constexpr VSFilterMode fmSerial {fmFrameState};
+#else
 #include <VapourSynth.h>
+#endif
 #include <cstring>
 #include <cmath>
 #include <string>
 #include <sstream>
 #include <vector>
+#include <initializer_list>
 #include <unordered_map>
 #include <algorithm>
 #include <mutex>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <immintrin.h>
 #include "ds_format.hpp"
 #include "ds_videoinfo.hpp"
 #include "ds_frame.hpp"
 
+#ifdef DS_VAPOURSYNTH_API4
+typedef void (*register_vsfilter_proc)(VSPlugin*, const VSPLUGINAPI*);
+#else
 typedef void (*register_vsfilter_proc)(VSRegisterFunction, VSPlugin*);
+#endif
 typedef void (*register_avsfilter_proc)(IScriptEnvironment* env);
 std::vector<register_vsfilter_proc> RegisterVSFilters();
 std::vector<register_avsfilter_proc> RegisterAVSFilters();
@@ -59,6 +80,8 @@ struct InDelegator
 
 struct FetchFrameFunctor
 {
-  virtual DSFrame operator()(int n) = 0;
+  // Input frame n, fetched through the host handles of the call that
+  // in_frames was made for.
+  virtual DSFrame operator()(int n, const DSFrameSet &in_frames) = 0;
   virtual ~FetchFrameFunctor() {}
 };
@@ -15,6 +15,11 @@ struct Filter
   virtual const char* AVSName() const { return "FilterFoo"; }
   virtual const MtMode AVSMode() const { return MT_SERIALIZED; }
   virtual const VSFilterMode VSMode() const { return fmSerial; }
+  // Output frame n only needs input frame n, which lets VapourSynth API 4
+  // schedule requests as strictly spatial.
+  virtual bool VSSpatialOnly() const { return false; }
+  // Frames after the one requested that AVSWrapper computes in the background.
+  virtual int AVSPrefetch() const { return 0; }
   virtual const std::vector<Param> Params() const = 0;
   virtual const std::string VSParams() const
   {
@@ -25,7 +30,11 @@ struct Filter
       if (!p.VSEnabled) continue;
       std::string type_name;
       switch(p.Type) {
+#ifdef DS_VAPOURSYNTH_API4
+        case Clip: type_name = "vnode"; break;
+#else
         case Clip: type_name = "clip"; break;
+#endif
         case Integer: type_name = "int"; break;
         case Float: type_name = "float"; break;
         case Boolean: type_name = "int"; break;
@@ -66,20 +75,39 @@ struct Filter
     this->in_vi = in_vi;
     this->fetch_frame = fetch_frame;
   };
-  virtual std::vector<int> RequestReferenceFrames(int n) const
+  virtual DSFrameRequest RequestReferenceFrames(int n) const
   {
-    return std::vector<int>{n};
+    return DSFrameRequest{n};
   }
-  virtual DSFrame GetFrame(int n, std::unordered_map<int, DSFrame> in_frames)
+  virtual DSFrame GetFrame(int n, const DSFrameSet &in_frames)
   {
-    return in_frames.size() > 0 ? in_frames.begin()->second : DSFrame();
+    return in_frames.size() > 0 ? in_frames.Frames[0].Clone() : DSFrame();
   }
   virtual DSVideoInfo GetOutputVI()
   {
     return in_vi;
   }
+  // Input frames read on each side of frame n, 0 for spatial filters.
+  virtual int AVSCacheWindow() const { return 0; }
+  // Output frames a consumer re-reads around n. Until one says otherwise,
+  // assume a temporal filter may follow and keep a small window.
+  int output_cache_window {2};
   virtual int SetCacheHints(int cachehints, int frame_range)
   {
-    return cachehints == CACHE_GET_MTMODE ? AVSMode() : 0;
+    switch (cachehints) {
+      case CACHE_GET_MTMODE: return AVSMode();
+      // A consumer called SetCacheHints on this clip directly.
+      case CACHE_NOTHING: output_cache_window = 0; return 0;
+      case CACHE_WINDOW:
+      case CACHE_GENERIC:
+      case CACHE_FORCE_GENERIC: output_cache_window = frame_range; return 0;
+      // The filter never reads its own output, so the cache after it only
+      // has to hold what the filters downstream read again. Caching nothing
+      // is left to consumers known to read each frame once.
+      case CACHE_GETCHILD_CACHE_MODE: return output_cache_window > 1 ? CACHE_WINDOW : CACHE_NOTHING;
+      case CACHE_GETCHILD_CACHE_SIZE: return output_cache_window > 1 ? output_cache_window : 0;
+      case CACHE_GETCHILD_ACCESS_COST: return CACHE_ACCESS_RAND;
+      default: return 0;
+    }
   }
 };
@@ -11,6 +11,8 @@ struct DSFormat
 {
   bool IsFamilyYUV {true}, IsFamilyRGB {false}, IsFamilyYCC {false};
   bool IsInteger {true}, IsFloat {false};
+  // Packed YUY2: a single plane of Y0 U0 Y1 V0.
+  bool IsPacked {false};
   int SSW {0}, SSH {0};
   int BitsPerSample {8}, BytesPerSample {1};
   int Planes {3};
@@ -18,19 +20,46 @@ struct DSFormat
   DSFormat(const VSFormat* format)
   {
     Planes = format->numPlanes;
+#ifdef DS_VAPOURSYNTH_API4
+    IsFamilyYUV = format->colorFamily == cfYUV || format->colorFamily == cfGray;
+    IsFamilyRGB = format->colorFamily == cfRGB;
+    IsFamilyYCC = false;
+#else
     IsFamilyYUV = format->colorFamily == cmYUV || format->colorFamily == cmGray;
     IsFamilyRGB = format->colorFamily == cmRGB;
     IsFamilyYCC = format->colorFamily == cmYCoCg;
+#endif
     SSW = format->subSamplingW;
     SSH = format->subSamplingH;
     BitsPerSample = format->bitsPerSample;
     BytesPerSample = format->bytesPerSample;
     IsInteger = format->sampleType == stInteger;
     IsFloat = format->sampleType == stFloat;
+#ifndef DS_VAPOURSYNTH_API4
+    if (format->id == pfCompatYUY2) {
+      IsFamilyYUV = IsPacked = true;
+      SSW = 1;
+      SSH = 0;
+      BitsPerSample = 8;
+      BytesPerSample = 1;
+    }
+#endif
   }
 
+#ifdef DS_VAPOURSYNTH_API4
+  // API 4 formats are plain values and have no packed YUY2.
+  VSVideoFormat ToVSFormat(const VSCore* vscore, const VSAPI* vsapi) const
+  {
+    VSVideoFormat format {};
+    int family = IsFamilyRGB ? cfRGB : Planes == 1 ? cfGray : cfYUV;
+    vsapi->queryVideoFormat(&format, family, IsInteger ? stInteger : stFloat, BitsPerSample, SSW, SSH, const_cast<VSCore*>(vscore));
+    return format;
+  }
+#else
   const VSFormat* ToVSFormat(const VSCore* vscore, const VSAPI* vsapi) const
   {
+    if (IsPacked)
+      return vsapi->getFormatPreset(pfCompatYUY2, const_cast<VSCore*>(vscore));
     VSColorFamily family = cmYUV;
     if (IsFamilyYUV)
       family = Planes == 1 ? cmGray : cmYUV;
@@ -40,6 +69,7 @@ struct DSFormat
       family = cmYCoCg;
     return vsapi->registerFormat(family, IsInteger ? stInteger : stFloat, BitsPerSample, SSW, SSH, const_cast<VSCore*>(vscore));
   }
+#endif
 
   DSFormat(int format)
   {
@@ -67,10 +97,21 @@ struct DSFormat
       SSW = ((format >> VideoInfo::CS_Shift_Sub_Width) + 1) & 3;
       SSH = ((format >> VideoInfo::CS_Shift_Sub_Height) + 1) & 3;
     }
+
+    if (format == VideoInfo::CS_YUY2) {
+      IsFamilyYUV = IsPacked = true;
+      Planes = 1;
+      SSW = 1;
+      SSH = 0;
+      BitsPerSample = 8;
+      BytesPerSample = 1;
+    }
   }
 
   int ToAVSFormat() const
   {
+    if (IsPacked)
+      return VideoInfo::CS_YUY2;
     int pixel_format = VideoInfo::CS_PLANAR | (Planes == 3 ? VideoInfo::CS_YUV : VideoInfo::CS_YUVA) | VideoInfo::CS_VPlaneFirst;
     if (IsFamilyYUV) {
       pixel_format = VideoInfo::CS_PLANAR | (Planes == 3 ? VideoInfo::CS_YUV : VideoInfo::CS_YUVA) | VideoInfo::CS_VPlaneFirst;
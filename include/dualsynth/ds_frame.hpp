@@ -7,13 +7,24 @@
 
 #pragma once
 
+// An AviSynth+ output frame of the given format, allocated on the host
+// thread before the frame is filtered on another one.
+struct DSFrameAhead
+{
+  PVideoFrame Frame;
+  VideoInfo VI {};
+};
+
 struct DSFrame
 {
+  static constexpr int MaxPlanes {4};
+
   int FrameWidth {0}, FrameHeight {0};
 
-  const unsigned char ** SrcPointers {nullptr};
-  int * StrideBytes {nullptr};
-  unsigned char ** DstPointers {nullptr};
+  // Plane pointers are kept inline, so frames never allocate on their own.
+  const unsigned char * SrcPointers[MaxPlanes] {};
+  int StrideBytes[MaxPlanes] {};
+  unsigned char * DstPointers[MaxPlanes] {};
   DSFormat Format;
 
   // VapourSynth Interface
@@ -27,24 +38,31 @@ struct DSFrame
   PVideoFrame _avssrc;
   VideoInfo _vi;
   IScriptEnvironment * _env {nullptr};
-  int planes_y[4] = { PLANAR_Y, PLANAR_U, PLANAR_V, PLANAR_A };
-  int planes_r[4] = { PLANAR_R, PLANAR_G, PLANAR_B, PLANAR_A };
-  int *planes {0};
+  // Host has NewVideoFrameP, probed once by the wrapper.
+  bool _avs_has_v8 {false};
+  // Output frame the host thread allocated ahead, for frames filtered off
+  // that thread without an env.
+  DSFrameAhead * _avs_ahead {nullptr};
+  static constexpr int planes_y[4] = { PLANAR_Y, PLANAR_U, PLANAR_V, PLANAR_A };
+  static constexpr int planes_r[4] = { PLANAR_R, PLANAR_G, PLANAR_B, PLANAR_A };
+  const int *planes {nullptr};
 
   DSFrame() {}
   DSFrame(const VSCore* vscore, const VSAPI* vsapi)
     : _vscore(vscore), _vsapi(vsapi) {}
   DSFrame(const VSFrameRef* src, const VSCore* vscore, const VSAPI* vsapi)
     : _vssrc(src), _vscore(vscore), _vsapi(vsapi)
+#ifdef DS_VAPOURSYNTH_API4
+    , _vsformat(src ? _vsapi->getVideoFrameFormat(src) : nullptr)
+#else
     , _vsformat(src ? _vsapi->getFrameFormat(src) : nullptr)
+#endif
   {
     if (_vssrc) {
       Format = DSFormat(_vsformat);
       FrameWidth = _vsapi->getFrameWidth(src, 0);
       FrameHeight = _vsapi->getFrameHeight(src, 0);
 
-      SrcPointers = new const unsigned char*[Format.Planes];
-      StrideBytes = new int[Format.Planes];
       for (int i = 0; i < Format.Planes; i++) {
         SrcPointers[i] = _vsapi->getReadPtr(src, i);
         StrideBytes[i] = _vsapi->getStride(src, i);
@@ -52,10 +70,10 @@ struct DSFrame
     }
   }
 
-  DSFrame(IScriptEnvironment * env)
-    : _env(env) {}
-  DSFrame(PVideoFrame &src, VideoInfo vi, IScriptEnvironment * env)
-    : _avssrc(src), _vi(vi), _env(env)
+  DSFrame(IScriptEnvironment * env, bool has_v8)
+    : _env(env), _avs_has_v8(has_v8) {}
+  DSFrame(PVideoFrame &src, VideoInfo vi, IScriptEnvironment * env, bool has_v8)
+    : _avssrc(src), _vi(vi), _env(env), _avs_has_v8(has_v8)
   {
     if (_avssrc) {
       Format = DSFormat(_vi.pixel_type);
@@ -63,8 +81,6 @@ struct DSFrame
       FrameWidth = _vi.width;
       FrameHeight = _vi.height;
 
-      SrcPointers = new const unsigned char*[Format.Planes];
-      StrideBytes = new int[Format.Planes];
       for (int i = 0; i < Format.Planes; i++) {
         SrcPointers[i] = src->GetReadPtr(planes[i]);
         StrideBytes[i] = src->GetPitch(planes[i]);
@@ -72,171 +88,229 @@ struct DSFrame
     }
   }
 
-  DSFrame Create() { return Create(false, false); }
-  DSFrame Create(bool copy) { return Create(copy, false); }
-  DSFrame Create(bool copy, bool inplace)
+  DSFrame Create() const { return Create(false); }
+  DSFrame Create(bool copy) const
+  {
+    bool copy_planes[MaxPlanes] {copy, copy, copy, copy};
+    return Create(copy_planes);
+  }
+  // New frame of the same format whose planes in copy_planes already hold
+  // the source. VapourSynth shares those planes by reference, AviSynth+
+  // copies them. They have no DstPointers and must not be written.
+  DSFrame Create(const bool (&copy_planes)[MaxPlanes]) const
   {
     if (_vssrc) {
       // Create a new VS frame
-      const VSFrameRef* copy_frames[1] {ToVSFrame()};
-      int copy_planes[4] = {0};
-      auto vsframe = copy ?
-        _vsapi->newVideoFrame2(_vsformat, FrameWidth, FrameHeight, copy_frames, copy_planes, _vssrc, const_cast<VSCore*>(_vscore)) :
-        _vsapi->newVideoFrame(_vsformat, FrameWidth, FrameHeight, _vssrc, const_cast<VSCore*>(_vscore));
-      _vsapi->freeFrame(copy_frames[0]);
+      const VSFrameRef* plane_src[MaxPlanes] {};
+      int plane_index[MaxPlanes] {};
+      for (int i = 0; i < Format.Planes; i++)
+        if (copy_planes[i]) {
+          plane_src[i] = _vssrc;
+          plane_index[i] = i;
+        }
+      auto vsframe = _vsapi->newVideoFrame2(_vsformat, FrameWidth, FrameHeight, plane_src, plane_index, _vssrc, const_cast<VSCore*>(_vscore));
 
       DSFrame new_frame(vsframe, _vscore, _vsapi);
       new_frame._vsdst = vsframe;
-      new_frame.DstPointers = new unsigned char*[Format.Planes];
       for (int i = 0; i < Format.Planes; i++)
-        new_frame.DstPointers[i] = _vsapi->getWritePtr(vsframe, i);
+        new_frame.DstPointers[i] = copy_planes[i] ? nullptr : _vsapi->getWritePtr(vsframe, i);
       return new_frame;
     }
     else if(_avssrc) {
       // Create a new AVS frame
-      return Create(_vi);
+      DSFrame new_frame = Create(DSVideoInfo(_vi));
+      for (int i = 0; i < Format.Planes; i++)
+        if (copy_planes[i]) {
+          StreamCopy(new_frame.DstPointers[i], new_frame.StrideBytes[i], SrcPointers[i], StrideBytes[i],
+                     _avssrc->GetRowSize(planes[i]), _avssrc->GetHeight(planes[i]));
+          new_frame.DstPointers[i] = nullptr;
+        }
+      return new_frame;
     }
     throw "Unable to create from nothing.";
   }
-  DSFrame Create(DSVideoInfo vi) {
-    planes = vi.Format.IsFamilyYUV ? planes_y : planes_r;
+  DSFrame Create(DSVideoInfo vi) const {
+    const int *vi_planes = vi.Format.IsFamilyYUV ? planes_y : planes_r;
     if (_vsapi) {
+#ifdef DS_VAPOURSYNTH_API4
+      auto vsformat = vi.Format.ToVSFormat(_vscore, _vsapi);
+      auto vsframe = _vsapi->newVideoFrame(&vsformat, vi.Width, vi.Height, _vssrc, const_cast<VSCore*>(_vscore));
+#else
       auto vsframe = _vsapi->newVideoFrame(vi.Format.ToVSFormat(_vscore, _vsapi), vi.Width, vi.Height, _vssrc, const_cast<VSCore*>(_vscore));
+#endif
       DSFrame new_frame(vsframe, _vscore, _vsapi);
       new_frame._vsdst = vsframe;
-      new_frame.DstPointers = new unsigned char*[Format.Planes];
-      for (int i = 0; i < Format.Planes; i++)
+      for (int i = 0; i < new_frame.Format.Planes; i++)
         new_frame.DstPointers[i] = _vsapi->getWritePtr(vsframe, i);
       return new_frame;
     }
-    else if (_env) {
+    else if (_env || _avs_ahead) {
       auto avsvi = vi.ToAVSVI();
-      bool has_at_least_v8 = true;
-      try { _env->CheckVersion(8); }
-      catch (const AvisynthError&) { has_at_least_v8 = false; }
-      auto new_avsframe = (has_at_least_v8) ? _env->NewVideoFrameP(avsvi, &_avssrc) : _env->NewVideoFrame(avsvi);
-      auto dstp = new unsigned char*[Format.Planes];
-      for (int i = 0; i < Format.Planes; i++)
-        dstp[i] = new_avsframe->GetWritePtr(planes[i]);
-      DSFrame new_frame(new_avsframe, avsvi, _env);
-      new_frame.DstPointers = dstp;
+      PVideoFrame new_avsframe;
+      if (_avs_ahead && _avs_ahead->Frame && _avs_ahead->VI.width == avsvi.width &&
+          _avs_ahead->VI.height == avsvi.height && _avs_ahead->VI.pixel_type == avsvi.pixel_type) {
+        new_avsframe = _avs_ahead->Frame;
+        _avs_ahead->Frame = nullptr;
+      }
+      else if (_env)
+        new_avsframe = _avs_has_v8 ? _env->NewVideoFrameP(avsvi, const_cast<PVideoFrame*>(&_avssrc)) : _env->NewVideoFrame(avsvi);
+      else
+        throw "No output frame was allocated ahead.";
+      DSFrame new_frame(new_avsframe, avsvi, _env, _avs_has_v8);
+      for (int i = 0; i < new_frame.Format.Planes; i++)
+        new_frame.DstPointers[i] = new_avsframe->GetWritePtr(vi_planes[i]);
       return new_frame;
     }
     throw "Unable to create from nothing.";
   }
 
-  const VSFrameRef* ToVSFrame()
+  const VSFrameRef* ToVSFrame() const
   {
-    return _vsdst ? _vsapi->cloneFrameRef(_vsdst) :
-           _vssrc ? _vsapi->cloneFrameRef(_vssrc) :
+    return _vsdst ? AddRef(_vsdst) :
+           _vssrc ? AddRef(_vssrc) :
            nullptr;
   }
-  PVideoFrame ToAVSFrame() {return _avssrc ? _avssrc : nullptr;}
+  PVideoFrame ToAVSFrame() const {return _avssrc ? _avssrc : nullptr;}
 
-  ~DSFrame()
+  // Frames are move only. Clone takes new references to the same frames.
+  DSFrame Clone() const
   {
-    if (SrcPointers)
-      delete[] SrcPointers;
-    if (DstPointers)
-      delete[] DstPointers;
-    if (StrideBytes)
-      delete[] StrideBytes;
-    if (_vsdst && _vsdst != _vssrc)
-      _vsapi->freeFrame(_vsdst);
+    DSFrame frame;
+    frame._avssrc = _avssrc;
+    std::memcpy(&frame, this, sizeof(DSFrame));
     if (_vssrc)
-      _vsapi->freeFrame(_vssrc);
+      frame._vssrc = AddRef(_vssrc);
+    if (_vsdst)
+      frame._vsdst = _vsdst == _vssrc ? const_cast<VSFrameRef*>(frame._vssrc) : const_cast<VSFrameRef*>(AddRef(_vsdst));
+    return frame;
+  }
+
+  ~DSFrame()
+  {
+    Release();
   }
 
-  DSFrame(const DSFrame & old)
+  DSFrame(const DSFrame &) = delete;
+  DSFrame& operator =(const DSFrame &) = delete;
+  DSFrame(DSFrame && old) noexcept
   {
     _avssrc = old._avssrc;
     std::memcpy(this, &old, sizeof(DSFrame));
-    if (old.SrcPointers) {
-      SrcPointers = new const unsigned char*[Format.Planes];
-      std::copy_n(old.SrcPointers, Format.Planes, SrcPointers);
-    }
-    if (old.DstPointers) {
-      DstPointers = new unsigned char*[Format.Planes];
-      std::copy_n(old.DstPointers, Format.Planes, DstPointers);
-    }
-    if (old.StrideBytes) {
-      StrideBytes = new int[Format.Planes];
-      std::copy_n(old.StrideBytes, Format.Planes, StrideBytes);
-    }
-    if (_vsdst && _vsdst != _vssrc)
-      _vsdst = const_cast<VSFrameRef*>(_vsapi->cloneFrameRef(old._vsdst));
-    if (_vssrc)
-      _vssrc = _vsapi->cloneFrameRef(old._vssrc);
+    old._vssrc = nullptr;
+    old._vsdst = nullptr;
   }
-  DSFrame& operator =(const DSFrame & old)
+  DSFrame& operator =(DSFrame && old) noexcept
   {
     if (&old == this)
       return *this;
 
-    if (SrcPointers)
-      delete[] SrcPointers;
-    if (DstPointers)
-      delete[] DstPointers;
-    if (StrideBytes)
-      delete[] StrideBytes;
-    if (_vsdst && _vsdst != _vssrc)
-      _vsapi->freeFrame(_vsdst);
-    if (_vssrc)
-      _vsapi->freeFrame(_vssrc);
-
+    Release();
     _avssrc = old._avssrc;
     std::memcpy(this, &old, sizeof(DSFrame));
-    if (old.SrcPointers) {
-      SrcPointers = new const unsigned char*[Format.Planes];
-      std::copy_n(old.SrcPointers, Format.Planes, SrcPointers);
-    }
-    if (old.DstPointers) {
-      DstPointers = new unsigned char*[Format.Planes];
-      std::copy_n(old.DstPointers, Format.Planes, DstPointers);
-    }
-    if (old.StrideBytes) {
-      StrideBytes = new int[Format.Planes];
-      std::copy_n(old.StrideBytes, Format.Planes, StrideBytes);
-    }
-    if (_vsdst && _vsdst != _vssrc)
-      _vsdst = const_cast<VSFrameRef*>(_vsapi->cloneFrameRef(old._vsdst));
-    if (_vssrc)
-      _vssrc = _vsapi->cloneFrameRef(old._vssrc);
+    old._vssrc = nullptr;
+    old._vsdst = nullptr;
     return *this;
   }
-  DSFrame(DSFrame && old) noexcept
+
+private:
+  const VSFrameRef* AddRef(const VSFrameRef* frame) const
   {
-    _avssrc = old._avssrc;
-    std::memcpy(this, &old, sizeof(DSFrame));
-    old.SrcPointers = nullptr;
-    old.DstPointers = nullptr;
-    old.StrideBytes = nullptr;
-    old._vssrc = nullptr;
-    old._vsdst = nullptr;
+#ifdef DS_VAPOURSYNTH_API4
+    return _vsapi->addFrameRef(frame);
+#else
+    return _vsapi->cloneFrameRef(frame);
+#endif
   }
-  DSFrame& operator =(DSFrame && old) noexcept
+
+  // Plane copy with streaming stores, so the copied planes do not evict the
+  // ones being filtered from the cache.
+  static void StreamCopy(unsigned char * dst, int dst_stride, const unsigned char * src, int src_stride, int row_size, int height)
   {
-    if (&old == this)
-      return *this;
+    for (int y = 0; y < height; y++) {
+      int x = 0;
+      if ((reinterpret_cast<uintptr_t>(dst) & 15) == 0) {
+        for (; x + 64 <= row_size; x += 64) {
+          __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+          __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 16));
+          __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 32));
+          __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 48));
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x), v0);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x + 16), v1);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x + 32), v2);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x + 48), v3);
+        }
+      }
+      std::memcpy(dst + x, src + x, row_size - x);
+      dst += dst_stride;
+      src += src_stride;
+    }
+    _mm_sfence();
+  }
 
-    if (SrcPointers)
-      delete[] SrcPointers;
-    if (DstPointers)
-      delete[] DstPointers;
-    if (StrideBytes)
-      delete[] StrideBytes;
+  void Release()
+  {
     if (_vsdst && _vsdst != _vssrc)
       _vsapi->freeFrame(_vsdst);
     if (_vssrc)
       _vsapi->freeFrame(_vssrc);
+    _vssrc = nullptr;
+    _vsdst = nullptr;
+  }
+};
 
-    _avssrc = old._avssrc;
-    std::memcpy(this, &old, sizeof(DSFrame));
-    old.SrcPointers = nullptr;
-    old.DstPointers = nullptr;
-    old.StrideBytes = nullptr;
-    old._vssrc = nullptr;
-    old._vsdst = nullptr;
-    return *this;
+// Frame numbers a filter reads for one output frame.
+struct DSFrameRequest
+{
+  static constexpr int MaxFrames {8};
+
+  int Count {0};
+  int Numbers[MaxFrames] {};
+
+  DSFrameRequest() {}
+  DSFrameRequest(std::initializer_list<int> numbers)
+  {
+    for (auto n : numbers)
+      Add(n);
+  }
+
+  void Add(int n)
+  {
+    if (Count == MaxFrames)
+      throw "Too many reference frames.";
+    Numbers[Count++] = n;
+  }
+  const int * begin() const { return Numbers; }
+  const int * end() const { return Numbers + Count; }
+};
+
+// Input frames of one output frame in request order, stored inline so
+// handing them to GetFrame does not allocate.
+struct DSFrameSet
+{
+  int Count {0};
+  int Numbers[DSFrameRequest::MaxFrames] {};
+  DSFrame Frames[DSFrameRequest::MaxFrames];
+  // Host handles of the GetFrame call the set was made for. Frames fetched
+  // during that call go through them.
+  IScriptEnvironment *AVSEnv {nullptr};
+  VSFrameContext *VSFrameCtx {nullptr};
+
+  void Add(int n, DSFrame && frame)
+  {
+    if (Count == DSFrameRequest::MaxFrames)
+      throw "Too many reference frames.";
+    Numbers[Count] = n;
+    Frames[Count++] = std::move(frame);
+  }
+  int size() const { return Count; }
+
+  // Frame n, or an empty frame if it was not requested.
+  const DSFrame& operator[](int n) const
+  {
+    for (int i = 0; i < Count; i++)
+      if (Numbers[i] == n)
+        return Frames[i];
+    static const DSFrame empty;
+    return empty;
   }
 };
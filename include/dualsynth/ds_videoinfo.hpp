@@ -29,7 +29,11 @@ struct DSVideoInfo
     , Frames(frames)
   { }
   DSVideoInfo(const VSVideoInfo* vsvi)
+#ifdef DS_VAPOURSYNTH_API4
+    : Format(&vsvi->format)
+#else
     : Format(vsvi->format)
+#endif
     , FPSNum(vsvi->fpsNum), FPSDenom(vsvi->fpsDen)
     , Width(vsvi->width), Height(vsvi->height)
     , Frames(vsvi->numFrames)
@@ -46,7 +50,11 @@ struct DSVideoInfo
     , Field(avsvi.image_type)
   { }
   const VSVideoInfo* ToVSVI(const VSCore* vscore, const VSAPI* vsapi) {
+#ifdef DS_VAPOURSYNTH_API4
+    return new VSVideoInfo {Format.ToVSFormat(vscore, vsapi), FPSNum, FPSDenom, Width, Height, Frames};
+#else
     return new VSVideoInfo {Format.ToVSFormat(vscore, vsapi), FPSNum, FPSDenom, Width, Height, Frames, 0};
+#endif
   }
   const VideoInfo ToAVSVI() {
     return VideoInfo{Width, Height, static_cast<unsigned>(FPSNum), static_cast<unsigned>(FPSDenom), Frames, Format.ToAVSFormat(), Audio_SPS, Audio_SType, Audio_NSamples, Audio_NChannels, Field};
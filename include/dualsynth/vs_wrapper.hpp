@@ -16,75 +16,81 @@ namespace Plugin {
 namespace VSInterface {
   const VSAPI * API;
 
+#ifdef DS_VAPOURSYNTH_API4
+  #define DS_VS_MAP(name) map##name
+#else
+  #define DS_VS_MAP(name) prop##name
+#endif
+
   struct VSInDelegator final : InDelegator {
     const VSMap *_in;
     const VSAPI *_vsapi;
     int _err;
     void Read(const char* name, int& output) override {
       auto _default = output;
-      output = static_cast<int>(_vsapi->propGetInt(_in, name, 0, &_err));
+      output = static_cast<int>(_vsapi->DS_VS_MAP(GetInt)(_in, name, 0, &_err));
       if (_err) output = _default;
     }
     void Read(const char* name, int64_t& output) override {
       auto _default = output;
-      output = _vsapi->propGetInt(_in, name, 0, &_err);
+      output = _vsapi->DS_VS_MAP(GetInt)(_in, name, 0, &_err);
       if (_err) output = _default;
     }
     void Read(const char* name, float& output) override {
       auto _default = output;
-      output = static_cast<float>(_vsapi->propGetFloat(_in, name, 0, &_err));
+      output = static_cast<float>(_vsapi->DS_VS_MAP(GetFloat)(_in, name, 0, &_err));
       if (_err) output = _default;
     }
     void Read(const char* name, double& output) override {
       auto _default = output;
-      output = _vsapi->propGetFloat(_in, name, 0, &_err);
+      output = _vsapi->DS_VS_MAP(GetFloat)(_in, name, 0, &_err);
       if (_err) output = _default;
     }
     void Read(const char* name, bool& output) override {
-      auto output_int = _vsapi->propGetInt(_in, name, 0, &_err);
+      auto output_int = _vsapi->DS_VS_MAP(GetInt)(_in, name, 0, &_err);
       if (!_err) output = output_int != 0;
     }
     void Read(const char* name, std::string& output) override {
-      auto output_str = _vsapi->propGetData(_in, name, 0, &_err);
+      auto output_str = _vsapi->DS_VS_MAP(GetData)(_in, name, 0, &_err);
       if (!_err) output = output_str;
     }
     void Read(const char* name, std::vector<int>& output) override {
-      auto size = _vsapi->propNumElements(_in, name);
+      auto size = _vsapi->DS_VS_MAP(NumElements)(_in, name);
       if (size < 0) return;
       output.clear();
       for (int i = 0; i < size; i++)
-        output.push_back(static_cast<int>(_vsapi->propGetInt(_in, name, i, &_err)));
+        output.push_back(static_cast<int>(_vsapi->DS_VS_MAP(GetInt)(_in, name, i, &_err)));
     }
     void Read(const char* name, std::vector<int64_t>& output) override {
-      auto size = _vsapi->propNumElements(_in, name);
+      auto size = _vsapi->DS_VS_MAP(NumElements)(_in, name);
       if (size < 0) return;
       output.clear();
       for (int i = 0; i < size; i++)
-        output.push_back(_vsapi->propGetInt(_in, name, i, &_err));
+        output.push_back(_vsapi->DS_VS_MAP(GetInt)(_in, name, i, &_err));
     }
     void Read(const char* name, std::vector<float>& output) override {
-      auto size = _vsapi->propNumElements(_in, name);
+      auto size = _vsapi->DS_VS_MAP(NumElements)(_in, name);
       if (size < 0) return;
       output.clear();
       for (int i = 0; i < size; i++)
-        output.push_back(static_cast<float>(_vsapi->propGetFloat(_in, name, i, &_err)));
+        output.push_back(static_cast<float>(_vsapi->DS_VS_MAP(GetFloat)(_in, name, i, &_err)));
     }
     void Read(const char* name, std::vector<double>& output) override {
-      auto size = _vsapi->propNumElements(_in, name);
+      auto size = _vsapi->DS_VS_MAP(NumElements)(_in, name);
       if (size < 0) return;
       output.clear();
       for (int i = 0; i < size; i++)
-        output.push_back(_vsapi->propGetFloat(_in, name, i, &_err));
+        output.push_back(_vsapi->DS_VS_MAP(GetFloat)(_in, name, i, &_err));
     }
     void Read(const char* name, std::vector<bool>& output) override {
-      auto size = _vsapi->propNumElements(_in, name);
+      auto size = _vsapi->DS_VS_MAP(NumElements)(_in, name);
       if (size < 0) return;
       output.clear();
       for (int i = 0; i < size; i++)
-        output.push_back(_vsapi->propGetInt(_in, name, i, &_err));
+        output.push_back(_vsapi->DS_VS_MAP(GetInt)(_in, name, i, &_err));
     }
     void Read(const char* name, void*& output) override {
-      output = reinterpret_cast<void *>(_vsapi->propGetNode(_in, name, 0, &_err));
+      output = reinterpret_cast<void *>(_vsapi->DS_VS_MAP(GetNode)(_in, name, 0, &_err));
     }
     void Free(void*& clip) override {
       _vsapi->freeNode(reinterpret_cast<VSNodeRef *>(clip));
@@ -97,62 +103,63 @@ namespace VSInterface {
     VSNodeRef *_vs_clip;
     VSCore *_core;
     const VSAPI *_vsapi;
-    VSFrameContext *_frameCtx;
     VSFetchFrameFunctor(VSNodeRef *clip, VSCore *core, const VSAPI *vsapi)
       : _vs_clip(clip), _core(core), _vsapi(vsapi) {}
-    DSFrame operator()(int n) override {
-      return DSFrame(_vsapi->getFrameFilter(n, _vs_clip, _frameCtx), _core, _vsapi);
+    DSFrame operator()(int n, const DSFrameSet &in_frames) override {
+      if (!in_frames.VSFrameCtx)
+        throw "fetch_frame needs the frame set of the current call.";
+      return DSFrame(_vsapi->getFrameFilter(n, _vs_clip, in_frames.VSFrameCtx), _core, _vsapi);
     }
     ~VSFetchFrameFunctor() override {
       _vsapi->freeNode(_vs_clip);
     }
   };
 
+#ifndef DS_VAPOURSYNTH_API4
   template<typename FilterType>
   void VS_CC Initialize(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
     auto Data = reinterpret_cast<FilterType*>(*instanceData);
     auto output_vi = Data->GetOutputVI();
     vsapi->setVideoInfo(output_vi.ToVSVI(core, vsapi), 1, node);
   }
+#endif
 
   template<typename FilterType>
-  void VS_CC Delete(void *instanceData, VSCore *core, const VSAPI *vsapi) {
-    auto filter = reinterpret_cast<FilterType*>(instanceData);
+  void FreeFilter(FilterType *filter) {
     auto functor = reinterpret_cast<VSFetchFrameFunctor*>(filter->fetch_frame);
     delete functor;
     delete filter;
   }
 
   template<typename FilterType>
-  const VSFrameRef* VS_CC GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    auto filter = reinterpret_cast<FilterType*>(*instanceData);
+  const VSFrameRef* FilterGetFrame(FilterType *filter, int n, int activationReason, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     auto functor = reinterpret_cast<VSFetchFrameFunctor*>(filter->fetch_frame);
-    if (functor)
-      functor->_frameCtx = frameCtx;
 
-    std::vector<int> ref_frames;
-    if (activationReason == VSActivationReason::arInitial) {
+    DSFrameRequest ref_frames;
+    if (activationReason == arInitial) {
       if (functor) {
         ref_frames = filter->RequestReferenceFrames(n);
         for (auto &&i : ref_frames)
           vsapi->requestFrameFilter(i, functor->_vs_clip, frameCtx);
       }
       else {
-        std::unordered_map<int, DSFrame> in_frames;
-        in_frames[n] = DSFrame(core, vsapi);
+        DSFrameSet in_frames;
+        in_frames.VSFrameCtx = frameCtx;
+        in_frames.Add(n, DSFrame(core, vsapi));
         auto vs_frame = (filter->GetFrame(n, in_frames).ToVSFrame());
         return vs_frame;
       }
     }
-    else if (activationReason == VSActivationReason::arAllFramesReady) {
-      std::unordered_map<int, DSFrame> in_frames;
+    else if (activationReason == arAllFramesReady) {
+      DSFrameSet in_frames;
+      in_frames.VSFrameCtx = frameCtx;
       if (functor) {
         ref_frames = filter->RequestReferenceFrames(n);
         for (auto &&i : ref_frames)
-          in_frames[i] = DSFrame(vsapi->getFrameFilter(i, functor->_vs_clip, frameCtx), core, vsapi);
+          in_frames.Add(i, DSFrame(vsapi->getFrameFilter(i, functor->_vs_clip, frameCtx), core, vsapi));
       }
       else
-        in_frames[n] = DSFrame(core, vsapi);
+        in_frames.Add(n, DSFrame(core, vsapi));
 
       auto vs_frame = (filter->GetFrame(n, in_frames).ToVSFrame());
       return vs_frame;
@@ -160,6 +167,28 @@ namespace VSInterface {
     return nullptr;
   }
 
+#ifdef DS_VAPOURSYNTH_API4
+  template<typename FilterType>
+  void VS_CC Free(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    FreeFilter(reinterpret_cast<FilterType*>(instanceData));
+  }
+
+  template<typename FilterType>
+  const VSFrame* VS_CC GetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    return FilterGetFrame(reinterpret_cast<FilterType*>(instanceData), n, activationReason, frameCtx, core, vsapi);
+  }
+#else
+  template<typename FilterType>
+  void VS_CC Delete(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    FreeFilter(reinterpret_cast<FilterType*>(instanceData));
+  }
+
+  template<typename FilterType>
+  const VSFrameRef* VS_CC GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    return FilterGetFrame(reinterpret_cast<FilterType*>(*instanceData), n, activationReason, frameCtx, core, vsapi);
+  }
+#endif
+
   template<typename FilterType>
   void VS_CC Create(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     auto filter = new FilterType{};
@@ -178,16 +207,38 @@ namespace VSInterface {
       }
       catch(const char *) { /* No clip, source filter */ }
       filter->Initialize(&argument, input_vi, functor);
+#ifdef DS_VAPOURSYNTH_API4
+      auto output_vi = filter->GetOutputVI().ToVSVI(core, vsapi);
+      VSFilterDependency deps[1] {{functor ? functor->_vs_clip : nullptr, filter->VSSpatialOnly() ? rpStrictSpatial : rpGeneral}};
+      vsapi->createVideoFilter(out, filter->VSName(), output_vi, GetFrame<FilterType>, Free<FilterType>, filter->VSMode(), deps, functor ? 1 : 0, filter, core);
+      delete output_vi;
+#else
       vsapi->createFilter(in, out, filter->VSName(), Initialize<FilterType>, GetFrame<FilterType>, Delete<FilterType>, filter->VSMode(), 0, filter, core);
+#endif
     }
     catch(const char *err){
       char msg_buff[256];
       snprintf(msg_buff, 256, "%s: %s", filter->VSName(), err);
+#ifdef DS_VAPOURSYNTH_API4
+      vsapi->mapSetError(out, msg_buff);
+#else
       vsapi->setError(out, msg_buff);
+#endif
       delete filter;
     }
   }
 
+#ifdef DS_VAPOURSYNTH_API4
+  template<typename FilterType>
+  void RegisterFilter(VSPlugin* vsplugin, const VSPLUGINAPI* vspapi) {
+    FilterType filter;
+    vspapi->registerFunction(filter.VSName(), filter.VSParams().c_str(), "clip:vnode;", Create<FilterType>, nullptr, vsplugin);
+  }
+
+  void RegisterPlugin(VSPlugin* vsplugin, const VSPLUGINAPI* vspapi) {
+    vspapi->configPlugin(Plugin::Identifier, Plugin::Namespace, Plugin::Description, VS_MAKE_VERSION(1, 0), VAPOURSYNTH_API_VERSION, 0, vsplugin);
+  }
+#else
   template<typename FilterType>
   void RegisterFilter(VSRegisterFunction registerFunc, VSPlugin* vsplugin) {
     FilterType filter;
@@ -197,8 +248,18 @@ namespace VSInterface {
   void RegisterPlugin(VSConfigPlugin configFunc, VSPlugin* vsplugin) {
     configFunc(Plugin::Identifier, Plugin::Namespace, Plugin::Description, VAPOURSYNTH_API_VERSION, 1, vsplugin);
   }
+#endif
 }
 
+#ifdef DS_VAPOURSYNTH_API4
+VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin* vsplugin, const VSPLUGINAPI* vspapi) {
+  VSInterface::RegisterPlugin(vsplugin, vspapi);
+  auto filters = RegisterVSFilters();
+  for (auto &&RegisterFilter : filters) {
+    RegisterFilter(vsplugin, vspapi);
+  }
+}
+#else
 VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin* vsplugin) {
   VSInterface::RegisterPlugin(configFunc, vsplugin);
   auto filters = RegisterVSFilters();
@@ -206,3 +267,4 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
     RegisterFilter(registerFunc, vsplugin);
   }
 }
+#endif
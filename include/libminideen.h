@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 Xinyue Lu
+ *
+ * MiniDeen - C interface to the kernels, without AviSynth+ or VapourSynth.
+ *
+ */
+
+#ifndef LIBMINIDEEN_H
+#define LIBMINIDEEN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32) && defined(MINIDEEN_DLL)
+#  ifdef MINIDEEN_BUILD
+#    define MINIDEEN_API __declspec(dllexport)
+#  else
+#    define MINIDEEN_API __declspec(dllimport)
+#  endif
+#else
+#  define MINIDEEN_API
+#endif
+
+typedef struct minideen_context minideen_context;
+
+typedef struct minideen_params {
+  int bits_per_sample; /* 8..16 */
+  int radius;          /* 1..7 */
+  int threshold;       /* 0..255 on the 8 bit scale, below 2 copies the plane */
+  int opt;             /* 0 auto, 1 C, 2 up to SSE2, 3 up to AVX2 */
+} minideen_params;
+
+/* Returns NULL and sets *error, when error is not NULL, on invalid params. */
+MINIDEEN_API minideen_context *minideen_create(const minideen_params *params, const char **error);
+MINIDEEN_API void minideen_free(minideen_context *ctx);
+
+/*
+ * Filter one plane of width x height samples. Buffers need no padding or
+ * alignment; rows whose vector loads and stores could leave them go
+ * through an internal copy. Strides are in bytes, and a multiple of 2 for
+ * more than 8 bits. A context may be used from several threads at
+ * once. Returns 0, or -1 on invalid arguments.
+ */
+MINIDEEN_API int minideen_process_plane(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height);
+
+/*
+ * Filter the interleaved U/V plane of NV12, P010 and the like in place of
+ * two planar passes. Width counts U/V pairs; U and V each take the
+ * context's threshold and neighbourhood. Same rules and result as above.
+ */
+MINIDEEN_API int minideen_process_uv(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height);
+
+/*
+ * Output rows y0 .. y1 - 1 of the plane above, with rows from y0 - radius
+ * to y1 - 1 + radius read from src. Lets callers split a plane between
+ * threads. Returns 0, or -1 on invalid arguments.
+ */
+MINIDEEN_API int minideen_process_rows(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height, int y0, int y1);
+
+/*
+ * Filters a plane as its source rows arrive. Each push says how many rows
+ * from the top of src are in place; every output row whose neighbourhood
+ * is then complete, row y once y + radius + 1 rows are, is written and
+ * handed to the callback, in top to bottom order and before the push
+ * returns. The result equals minideen_process_plane.
+ */
+typedef struct minideen_stream minideen_stream;
+typedef void (*minideen_rows_callback)(void *user, int y0, int y1);
+
+/* Returns NULL on invalid arguments. The callback may be NULL. */
+MINIDEEN_API minideen_stream *minideen_stream_create(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height, minideen_rows_callback done, void *user);
+/* Returns the output rows written so far, or -1 on invalid arguments. */
+MINIDEEN_API int minideen_stream_push(minideen_stream *stream, int rows);
+MINIDEEN_API void minideen_stream_free(minideen_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+#include "include/libminideen.h"
+#include "minideen_common.h"
+#include "minideen_stream.h"
+#include <avs/cpuid.h>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+int GetCPUFlags();
+
+MiniDeenKernel minideen_kernel(int bytes_per_sample, int opt) {
+  int CPUFlags = GetCPUFlags();
+  bool sse2 = (CPUFlags & CPUF_SSE2) && (opt <= 0 || opt > 1);
+  bool avx2 = (CPUFlags & CPUF_AVX2) && (opt <= 0 || opt > 2);
+  if (bytes_per_sample == 1)
+    return avx2 ? minideen_AVX2_8 : sse2 ? minideen_SSE2_8 : minideen_C<uint8_t>;
+  return avx2 ? minideen_AVX2_16 : sse2 ? minideen_SSE2_16 : minideen_C<uint16_t>;
+}
+
+struct minideen_context {
+  Neighbourhood nb;
+  unsigned threshold;
+  int bytes_per_sample;
+  bool simd;
+  MiniDeenKernel kernel;
+};
+
+// The vector kernels read up to this far before and after a row, and store
+// whole aligned vectors past its end.
+static constexpr int edge_bytes {128};
+static constexpr int store_alignment {32};
+static constexpr int band {32};
+
+minideen_context *minideen_create(const minideen_params *params, const char **error) {
+  const char *message = nullptr;
+  if (!params)
+    message = "params must not be NULL.";
+  else if (params->bits_per_sample < 8 || params->bits_per_sample > 16)
+    message = "bits_per_sample must be between 8 and 16 (inclusive).";
+  else if (params->radius < 1 || params->radius > max_radius)
+    message = "radius must be between 1 and 7 (inclusive).";
+  else if (params->threshold < 0 || params->threshold > 255)
+    message = "threshold must be between 0 and 255 (inclusive).";
+  if (message) {
+    if (error)
+      *error = message;
+    return nullptr;
+  }
+
+  auto ctx = new minideen_context;
+  ctx->nb = Neighbourhood(Square, params->radius, params->radius);
+  ctx->bytes_per_sample = params->bits_per_sample > 8 ? 2 : 1;
+  ctx->threshold = params->threshold * ((1 << params->bits_per_sample) - 1) / 255;
+  ctx->kernel = minideen_kernel(ctx->bytes_per_sample, params->opt);
+  ctx->simd = ctx->kernel != minideen_C<uint8_t> && ctx->kernel != minideen_C<uint16_t>;
+  return ctx;
+}
+
+void minideen_free(minideen_context *ctx) {
+  delete ctx;
+}
+
+static PlaneJob make_job(const minideen_context *ctx, PlaneLayout layout, const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride) {
+  PlaneJob job {srcp, dstp, src_stride, dst_stride, ctx->threshold, &ctx->nb};
+  if (layout == LayoutSemiPlanar) {
+    job.layout = LayoutSemiPlanar;
+    job.chroma_threshold[0] = job.chroma_threshold[1] = ctx->threshold;
+    job.chroma_nb = &ctx->nb;
+  }
+  return job;
+}
+
+static int row_bytes(const minideen_context *ctx, PlaneLayout layout, int width) {
+  return width * ctx->bytes_per_sample * (layout == LayoutSemiPlanar ? 2 : 1);
+}
+
+// Output rows y0 .. y1 - 1 through padded copies of their source and
+// destination rows.
+static void process_band_copied(const minideen_context *ctx, PlaneLayout layout, const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height, int y0, int y1, std::vector<uint8_t> &scratch) {
+  int bytes = row_bytes(ctx, layout, width);
+  int stride = ((bytes + 63) & ~63) + edge_bytes * 2;
+  int from = std::max(y0 - ctx->nb.radius_v, 0);
+  int to = std::min(y1 + ctx->nb.radius_v, height);
+  size_t total = static_cast<size_t>(stride) * (to - from + y1 - y0 + 1) + 64;
+  if (scratch.size() < total)
+    scratch.resize(total);
+  auto base = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(scratch.data()) + 63) & ~static_cast<uintptr_t>(63));
+  uint8_t *src_rows = base + edge_bytes;
+  uint8_t *dst_rows = base + static_cast<size_t>(stride) * (to - from + 1);
+
+  for (int y = from; y < to; y++)
+    memcpy(src_rows + static_cast<size_t>(y - from) * stride, src + static_cast<ptrdiff_t>(y) * src_stride, bytes);
+
+  PlaneJob job = make_job(ctx, layout, src_rows - static_cast<ptrdiff_t>(from) * stride, stride, dst_rows - static_cast<ptrdiff_t>(y0) * stride, stride);
+  ctx->kernel(&job, 1, width, height, y0, y1);
+
+  for (int y = y0; y < y1; y++)
+    memcpy(dst + static_cast<ptrdiff_t>(y) * dst_stride, dst_rows + static_cast<size_t>(y - y0) * stride, bytes);
+}
+
+static bool valid_plane(const minideen_context *ctx, PlaneLayout layout, const void *src, ptrdiff_t src_stride, const void *dst, ptrdiff_t dst_stride, int width, int height) {
+  if (!ctx || !src || !dst || width <= 0 || height <= 0 || width > INT_MAX / 4)
+    return false;
+  int bytes = row_bytes(ctx, layout, width);
+  if (src_stride < bytes || dst_stride < bytes || src_stride > INT_MAX || dst_stride > INT_MAX)
+    return false;
+  return src_stride % ctx->bytes_per_sample == 0 && dst_stride % ctx->bytes_per_sample == 0;
+}
+
+// Output rows y0 .. y1 - 1 of a validated plane.
+static void process_rows(const minideen_context *ctx, PlaneLayout layout, const uint8_t *srcp, ptrdiff_t src_stride, uint8_t *dstp, ptrdiff_t dst_stride, int width, int height, int y0, int y1) {
+  int bytes = row_bytes(ctx, layout, width);
+  if (ctx->threshold < 2) {
+    for (int y = y0; y < y1; y++)
+      memcpy(dstp + y * dst_stride, srcp + y * src_stride, bytes);
+    return;
+  }
+
+  // Away from the first and last rows the vector kernels stay within the
+  // buffers when the strides leave room for their reads and stores, and
+  // the destination rows are aligned.
+  int r = ctx->nb.radius_v;
+  bool direct = !ctx->simd ||
+    ((reinterpret_cast<uintptr_t>(dstp) | static_cast<uintptr_t>(dst_stride)) % store_alignment == 0 &&
+     src_stride >= bytes + edge_bytes && dst_stride >= ((bytes + store_alignment - 1) & -store_alignment));
+  int direct_y0 = !ctx->simd ? 0 : direct ? std::min(r + 1, height) : height;
+  int direct_y1 = !ctx->simd ? height : std::max(height - 1 - r, direct_y0);
+  direct_y0 = std::clamp(direct_y0, y0, y1);
+  direct_y1 = std::clamp(direct_y1, direct_y0, y1);
+
+  if (direct_y0 < direct_y1) {
+    PlaneJob job = make_job(ctx, layout, srcp, static_cast<int>(src_stride), dstp, static_cast<int>(dst_stride));
+    ctx->kernel(&job, 1, width, height, direct_y0, direct_y1);
+  }
+
+  std::vector<uint8_t> scratch;
+  for (int y = y0; y < direct_y0; y += band)
+    process_band_copied(ctx, layout, srcp, static_cast<int>(src_stride), dstp, static_cast<int>(dst_stride), width, height, y, std::min(y + band, direct_y0), scratch);
+  for (int y = direct_y1; y < y1; y += band)
+    process_band_copied(ctx, layout, srcp, static_cast<int>(src_stride), dstp, static_cast<int>(dst_stride), width, height, y, std::min(y + band, y1), scratch);
+}
+
+int minideen_process_plane(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height) {
+  if (!valid_plane(ctx, LayoutPlanar, src, src_stride, dst, dst_stride, width, height))
+    return -1;
+  process_rows(ctx, LayoutPlanar, static_cast<const uint8_t *>(src), src_stride, static_cast<uint8_t *>(dst), dst_stride, width, height, 0, height);
+  return 0;
+}
+
+int minideen_process_uv(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height) {
+  if (!valid_plane(ctx, LayoutSemiPlanar, src, src_stride, dst, dst_stride, width, height))
+    return -1;
+  process_rows(ctx, LayoutSemiPlanar, static_cast<const uint8_t *>(src), src_stride, static_cast<uint8_t *>(dst), dst_stride, width, height, 0, height);
+  return 0;
+}
+
+int minideen_process_rows(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height, int y0, int y1) {
+  if (!valid_plane(ctx, LayoutPlanar, src, src_stride, dst, dst_stride, width, height) || y0 < 0 || y1 > height || y0 > y1)
+    return -1;
+  process_rows(ctx, LayoutPlanar, static_cast<const uint8_t *>(src), src_stride, static_cast<uint8_t *>(dst), dst_stride, width, height, y0, y1);
+  return 0;
+}
+
+struct minideen_stream {
+  RowStream rows;
+};
+
+minideen_stream *minideen_stream_create(const minideen_context *ctx, const void *src, ptrdiff_t src_stride, void *dst, ptrdiff_t dst_stride, int width, int height, minideen_rows_callback done, void *user) {
+  if (!valid_plane(ctx, LayoutPlanar, src, src_stride, dst, dst_stride, width, height))
+    return nullptr;
+  auto srcp = static_cast<const uint8_t *>(src);
+  auto dstp = static_cast<uint8_t *>(dst);
+  RowStream::Callback run = [=](int y0, int y1) {
+    process_rows(ctx, LayoutPlanar, srcp, src_stride, dstp, dst_stride, width, height, y0, y1);
+  };
+  RowStream::Callback report;
+  if (done)
+    report = [=](int y0, int y1) { done(user, y0, y1); };
+  return new minideen_stream {RowStream(height, ctx->nb.radius_v, 1, band, std::move(run), std::move(report))};
+}
+
+int minideen_stream_push(minideen_stream *stream, int rows) {
+  if (!stream || rows < 0)
+    return -1;
+  stream->rows.push(rows);
+  return stream->rows.rows_done();
+}
+
+void minideen_stream_free(minideen_stream *stream) {
+  delete stream;
+}
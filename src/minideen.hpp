@@ -8,27 +8,52 @@
 #pragma once
 
 #include "minideen_common.h"
-
-int GetCPUFlags();
+#include "minideen_pool.h"
+#include "minideen_stream.h"
+#include <climits>
 
 // static constexpr int max_radius {15};
 // static constexpr int pixel_count {max_radius * max_radius + 2 + 1};
 
 struct MiniDeen : Filter {
   int process[4] {2, 2, 2, 2};
-  int threshold[3] {10, 12, 12};
-  int radius[3] {1, 1, 1};
+  int threshold[4] {10, 12, 12, 10};
+  int threshold_hi[4] {0, 0, 0, 0};
+  int radius[4] {1, 1, 1, 1};
+  int radius_h[4] {-1, -1, -1, -1};
+  int radius_v[4] {-1, -1, -1, -1};
+  std::string shape {"square"};
+  bool fields {false};
+  std::string guide {"none"};
+  bool guide_luma {false};
+  unsigned guide_threshold {0};
+  int scale {1};
+  bool pyramid {false};
+  std::string precision {"exact"};
+  bool approximate {false};
+  std::string mode {"mean"};
+  bool median {false};
+  int threads {1};
+  bool pooled {false};
+  int prefetch {0};
+  int pixel_max {255};
+  // Scratch for the half resolution planes of pyramid mode.
+  std::mutex scratch_mutex;
+  std::vector<std::vector<uint8_t>> scratch_pool;
+  Neighbourhood neighbourhood[4];
   int opt {0};
   InDelegator* _in;
   bool bypass {true};
   // uint16_t rcp[pixel_count] {0};
 
-  void (*minideen_core)(const uint8_t *, uint8_t *, int, int, int, int, unsigned, int);
+  MiniDeenKernel minideen_core;
 
   const char* VSName() const override { return "MiniDeen"; }
   const char* AVSName() const override { return "neo_minideen"; }
   const MtMode AVSMode() const override { return MT_NICE_FILTER; }
   const VSFilterMode VSMode() const override { return fmParallel; }
+  bool VSSpatialOnly() const override { return true; }
+  int AVSPrefetch() const override { return prefetch; }
   const std::vector<Param> Params() const override {
     return std::vector<Param> {
       Param {"clip", Clip, false, true, true, false},
@@ -43,41 +68,63 @@ struct MiniDeen : Filter {
       Param {"y", Integer, false, true, false},
       Param {"u", Integer, false, true, false},
       Param {"v", Integer, false, true, false},
-      Param {"opt", Integer}
+      Param {"a", Integer, false, true, false},
+      Param {"radiusA", Integer, false, true, false},
+      Param {"thrA", Integer, false, true, false},
+      Param {"opt", Integer},
+      Param {"shape", String},
+      Param {"radius_h", Integer, true, false, true},
+      Param {"radius_v", Integer, true, false, true},
+      Param {"radius_h", Integer, false, true, false},
+      Param {"radius_v", Integer, false, true, false},
+      Param {"fields", Boolean},
+      Param {"guide", String},
+      Param {"scale", Integer},
+      Param {"pyramid", Boolean},
+      Param {"precision", String},
+      Param {"threshold_hi", Integer, true, false, true},
+      Param {"thrY_hi", Integer, false, true, false},
+      Param {"thrUV_hi", Integer, false, true, false},
+      Param {"thrA_hi", Integer, false, true, false},
+      Param {"mode", String},
+      Param {"threads", Integer},
+      Param {"prefetch", Integer, false, true, false}
     };
   }
   void Initialize(InDelegator* in, DSVideoInfo in_vi, FetchFrameFunctor* fetch_frame) override
   {
     Filter::Initialize(in, in_vi, fetch_frame);
 
+    // YUY2 is a single packed plane, but its Y, U and V are set up like planes.
+    int components = in_vi.Format.IsPacked ? 3 : in_vi.Format.Planes;
+
+    // RGB channels are alike, so they all default to the first plane's threshold.
+    if (in_vi.Format.IsFamilyRGB)
+      threshold[1] = threshold[2] = threshold[0];
+
     try {
       std::vector<int> user_planes {0, 1, 2};
       std::vector<int> tmp;
       in->Read("planes", user_planes);
       for (auto &&p : user_planes)
       {
-        if (p < in_vi.Format.Planes)
+        if (p < components)
           process[p] = 3;
       }
       in->Read("radius", tmp);
-      if (tmp.size() > 0)
-        for (int i = 0; i < in_vi.Format.Planes; i++)
-        {
-          if (i < tmp.size())
-            radius[i] = tmp[i];
-          else
-            radius[i] = radius[i-1];
-        }
+      fill_planes(tmp, radius, components);
       tmp.clear();
       in->Read("threshold", tmp);
-      if (tmp.size() > 0)
-        for (int i = 0; i < in_vi.Format.Planes; i++)
-        {
-          if (i < tmp.size())
-            threshold[i] = tmp[i];
-          else
-            threshold[i] = threshold[i-1];
-        }
+      fill_planes(tmp, threshold, components);
+      tmp.clear();
+      in->Read("threshold_hi", tmp);
+      fill_planes(tmp, threshold_hi, components);
+      tmp.clear();
+      in->Read("radius_h", tmp);
+      fill_planes(tmp, radius_h, components);
+      tmp.clear();
+      in->Read("radius_v", tmp);
+      fill_planes(tmp, radius_v, components);
     }
     catch (const char *) {
       process[0] =
@@ -86,6 +133,7 @@ struct MiniDeen : Filter {
       in->Read("y", process[0]);
       in->Read("u", process[1]);
       in->Read("v", process[2]);
+      in->Read("a", process[3]);
 
       int radius_tmp = -1;
       in->Read("radius", radius_tmp);
@@ -103,67 +151,215 @@ struct MiniDeen : Filter {
       in->Read("thrUV", threshold_tmp);
       if (threshold_tmp >= 0)
         threshold[1] = threshold[2] = threshold_tmp;
+      else if (in_vi.Format.IsFamilyRGB)
+        threshold[1] = threshold[2] = threshold[0];
+
+      threshold_tmp = -1;
+      in->Read("thrY_hi", threshold_hi[0]);
+      in->Read("thrUV_hi", threshold_tmp);
+      if (threshold_tmp >= 0)
+        threshold_hi[1] = threshold_hi[2] = threshold_tmp;
+      else if (in_vi.Format.IsFamilyRGB)
+        threshold_hi[1] = threshold_hi[2] = threshold_hi[0];
+
+      in->Read("radiusA", radius[3]);
+      in->Read("thrA", threshold[3]);
+      in->Read("thrA_hi", threshold_hi[3]);
+
+      radius_tmp = -1;
+      in->Read("radius_h", radius_tmp);
+      if (radius_tmp >= 0)
+        radius_h[0] = radius_h[1] = radius_h[2] = radius_h[3] = radius_tmp;
+
+      radius_tmp = -1;
+      in->Read("radius_v", radius_tmp);
+      if (radius_tmp >= 0)
+        radius_v[0] = radius_v[1] = radius_v[2] = radius_v[3] = radius_tmp;
     }
     in->Read("opt", opt);
+    in->Read("shape", shape);
+    in->Read("fields", fields);
+    in->Read("guide", guide);
+    in->Read("scale", scale);
+    in->Read("pyramid", pyramid);
+    in->Read("precision", precision);
+    in->Read("mode", mode);
+    in->Read("threads", threads);
+    in->Read("prefetch", prefetch);
+
+    static const char* threshold_errors[2][4] {
+      {"threshold (Y) must be between 2 and 255 (inclusive).", "threshold (U) must be between 2 and 255 (inclusive).",
+       "threshold (V) must be between 2 and 255 (inclusive).", "threshold (A) must be between 2 and 255 (inclusive)."},
+      {"threshold (R) must be between 2 and 255 (inclusive).", "threshold (G) must be between 2 and 255 (inclusive).",
+       "threshold (B) must be between 2 and 255 (inclusive).", "threshold (A) must be between 2 and 255 (inclusive)."}
+    };
+    static const char* radius_errors[2][4] {
+      {"radius (Y) must be between 1 and 7 (inclusive).", "radius (U) must be between 1 and 7 (inclusive).",
+       "radius (V) must be between 1 and 7 (inclusive).", "radius (A) must be between 1 and 7 (inclusive)."},
+      {"radius (R) must be between 1 and 7 (inclusive).", "radius (G) must be between 1 and 7 (inclusive).",
+       "radius (B) must be between 1 and 7 (inclusive).", "radius (A) must be between 1 and 7 (inclusive)."}
+    };
+    int family = in_vi.Format.IsFamilyRGB ? 1 : 0;
+    for (int i = 0; i < 4; i++) {
+      if ((threshold[i] < 0 || threshold[i] > 255) && process[i] == 3)
+        throw(threshold_errors[family][i]);
+      if ((radius[i] < 1 || radius[i] > 7) && process[i] == 3)
+        throw(radius_errors[family][i]);
+      if (threshold_hi[i] != 0 && (threshold_hi[i] < threshold[i] || threshold_hi[i] > 255) && process[i] == 3)
+        throw("threshold_hi must be 0 or between threshold and 255 (inclusive).");
+      if (threshold_hi[i] > threshold[i] && process[i] == 3 && mode == "median")
+        throw("threshold_hi cannot be combined with mode=\"median\".");
+    }
+    for (int i = 0; i < 4; i++) {
+      if (radius_h[i] < 0) radius_h[i] = radius[i];
+      if (radius_v[i] < 0) radius_v[i] = radius[i];
+      if ((radius_h[i] > 7 || radius_v[i] > 7) && process[i] == 3)
+        throw("radius_h and radius_v must be between 0 and 7 (inclusive).");
+      if (radius_h[i] == 0 && radius_v[i] == 0 && process[i] == 3)
+        throw("radius_h and radius_v must not both be 0.");
+    }
 
-    if ((threshold[0] < 0 || threshold[0] > 255) && process[0] == 3)
-      throw("threshold (Y) must be between 2 and 255 (inclusive).");
-    if ((threshold[1] < 0 || threshold[1] > 255) && process[1] == 3)
-      throw("threshold (U) must be between 2 and 255 (inclusive).");
-    if ((threshold[2] < 0 || threshold[2] > 255) && process[2] == 3)
-      throw("threshold (V) must be between 2 and 255 (inclusive).");
-    if ((radius[0] < 1 || radius[0] > 7) && process[0] == 3)
-      throw("radius (Y) must be between 1 and 7 (inclusive).");
-    if ((radius[1] < 1 || radius[1] > 7) && process[1] == 3)
-      throw("radius (U) must be between 1 and 7 (inclusive).");
-    if ((radius[2] < 1 || radius[2] > 7) && process[2] == 3)
-      throw("radius (V) must be between 1 and 7 (inclusive).");
+    ShapeType shape_type;
+    if (shape == "square")
+      shape_type = Square;
+    else if (shape == "cross")
+      shape_type = Cross;
+    else if (shape == "diamond")
+      shape_type = Diamond;
+    else
+      throw("shape must be \"square\", \"cross\" or \"diamond\".");
+    if (precision == "fast")
+      approximate = true;
+    else if (precision != "exact")
+      throw("precision must be \"exact\" or \"fast\".");
+    if (mode == "median")
+      median = true;
+    else if (mode != "mean")
+      throw("mode must be \"mean\" or \"median\".");
+    if (threads < 0)
+      throw("threads must be 0 or above.");
+    if (threads != 1)
+      threads = threads == 0 ? pool_threads() : std::min(threads, pool_threads());
+    if (prefetch < 0 || prefetch > 16)
+      throw("prefetch must be between 0 and 16 (inclusive).");
+
+    for (int i = 0; i < 4; i++) {
+      neighbourhood[i] = Neighbourhood(shape_type, radius_h[i], radius_v[i]);
+      // Large neighbourhoods are averaged from half their taps in fast mode.
+      neighbourhood[i].sparse = approximate && std::max(radius_h[i], radius_v[i]) >= 3;
+      if (median)
+        neighbourhood[i].build_network();
+    }
     if (!in_vi.Format.IsInteger)
       throw("only 8..16 bit integer clips with constant format are supported.");
-    if (!in_vi.Format.IsFamilyYUV)
-      throw("only YUV clips are supported.");
+    if (!in_vi.Format.IsFamilyYUV && !in_vi.Format.IsFamilyRGB)
+      throw("only YUV and RGB clips are supported.");
+    if (guide == "luma") {
+      if (!in_vi.Format.IsFamilyYUV || in_vi.Format.IsPacked || components < 3)
+        throw("guide=\"luma\" requires a clip with chroma planes.");
+      guide_luma = true;
+    }
+    else if (guide != "none")
+      throw("guide must be \"none\" or \"luma\".");
+
+    if (scale != 1 && scale != 2)
+      throw("scale must be 1 or 2.");
+    if (scale == 2) {
+      if (in_vi.Format.IsPacked)
+        throw("scale=2 requires a planar clip.");
+      if (guide_luma || fields)
+        throw("scale=2 cannot be combined with guide or fields.");
+      if (in_vi.Width % (2 << in_vi.Format.SSW) || in_vi.Height % (2 << in_vi.Format.SSH))
+        throw("scale=2 requires the width and height to be divisible by twice the chroma subsampling.");
+    }
+
+    if (pyramid && (in_vi.Format.IsPacked || fields || scale == 2))
+      throw("pyramid cannot be combined with YUY2, fields or scale=2.");
+
+    for (int i = 0; i < 4; i++)
+      if (threshold[i] < 2 && process[i] == 3) process[i] = 2;
 
-    if (threshold[0] < 2 && process[0] == 3) process[0] = 2;
-    if (threshold[1] < 2 && process[1] == 3) process[1] = 2;
-    if (threshold[2] < 2 && process[2] == 3) process[2] = 2;
+    // Packed U and V are filtered in one pass with a shared neighbourhood.
+    if (in_vi.Format.IsPacked && process[1] == 3 && process[2] == 3 &&
+        (radius_h[1] != radius_h[2] || radius_v[1] != radius_v[2]))
+      throw("YUY2 clips need the same radius for U and V.");
 
-    int pixel_max = (1 << in_vi.Format.BitsPerSample) - 1;
+    pixel_max = (1 << in_vi.Format.BitsPerSample) - 1;
 
-    for (int i = 0; i < in_vi.Format.Planes; i++) {
+    // Decimated output can never be the source frame.
+    if (scale == 2)
+      bypass = false;
+    for (int i = 0; i < components; i++) {
       if (process[i] == 3)
         bypass = false;
       threshold[i] = threshold[i] * pixel_max / 255;
+      threshold_hi[i] = threshold_hi[i] * pixel_max / 255;
     }
 
+    guide_threshold = std::max(threshold[0], 1);
+
     // for (int i = 2; i < pixel_count; i++)
         // rcp[i] = (unsigned)(65536.0 / i + 0.5);
 
-    int CPUFlags = GetCPUFlags();
-    switch (in_vi.Format.BytesPerSample) {
-      case 1: minideen_core = minideen_C<uint8_t>; break;
-      case 2: minideen_core = minideen_C<uint16_t>; break;
-    }
+    minideen_core = minideen_kernel(in_vi.Format.BytesPerSample, opt);
 
-    if ((CPUFlags & CPUF_SSE2) && (opt <= 0 || opt > 1)) {
-      switch (in_vi.Format.BytesPerSample) {
-        case 1: minideen_core = minideen_SSE2_8; break;
-        case 2: minideen_core = minideen_SSE2_16; break;
-      }
-    }
-    if ((CPUFlags & CPUF_AVX2) && (opt <= 0 || opt > 2)) {
-      switch (in_vi.Format.BytesPerSample) {
-        case 1: minideen_core = minideen_AVX2_8; break;
-        case 2: minideen_core = minideen_AVX2_16; break;
-      }
+    if (threads > 1) {
+      pool_acquire();
+      pooled = true;
     }
   }
 
-  DSFrame GetFrame(int n, std::unordered_map<int, DSFrame> in_frames) override
+  // Per plane values from an array argument, the last one repeating for the
+  // planes after it. An empty array keeps the defaults.
+  static void fill_planes(const std::vector<int> &values, int (&target)[4], int components) {
+    if (values.empty())
+      return;
+    for (int i = 0; i < components; i++)
+      target[i] = i < static_cast<int>(values.size()) ? values[i] : target[i - 1];
+  }
+
+  DSVideoInfo GetOutputVI() override
   {
-    auto src = in_frames[n];
+    auto out_vi = in_vi;
+    out_vi.Width /= scale;
+    out_vi.Height /= scale;
+    return out_vi;
+  }
+
+  DSFrame GetFrame(int n, const DSFrameSet &in_frames) override
+  {
+    auto &src = in_frames[n];
     if (bypass)
-      return src;
-    auto dst = src.Create(false);
+      return src.Clone();
+    // Planes passed through unfiltered come with the new frame.
+    bool copy_planes[DSFrame::MaxPlanes] {};
+    if (scale == 1 && !in_vi.Format.IsPacked)
+      for (int p = 0; p < in_vi.Format.Planes; p++)
+        copy_planes[p] = process[p] == 2;
+    auto dst = scale == 2 ? src.Create(GetOutputVI()) : src.Create(copy_planes);
+
+    if (in_vi.Format.IsPacked) {
+      // Y, U and V of YUY2 are split in registers and filtered in one pass.
+      PlaneJob job {src.SrcPointers[0], dst.DstPointers[0], src.StrideBytes[0], dst.StrideBytes[0], static_cast<unsigned>(threshold[0]), &neighbourhood[0]};
+      job.layout = LayoutYUY2;
+      job.chroma_threshold[0] = threshold[1];
+      job.chroma_threshold[1] = threshold[2];
+      job.threshold_hi = threshold_hi[0];
+      job.chroma_threshold_hi[0] = threshold_hi[1];
+      job.chroma_threshold_hi[1] = threshold_hi[2];
+      job.chroma_nb = &neighbourhood[process[1] == 3 ? 1 : 2];
+      job.filter_luma = process[0] == 3;
+      job.filter_chroma[0] = process[1] == 3;
+      job.filter_chroma[1] = process[2] == 3;
+      job.approximate = approximate;
+      job.median = median;
+      process_planes(&job, &in_vi.Width, &in_vi.Height, 1);
+      return dst;
+    }
+
+    PlaneJob jobs[max_planes];
+    int widths[max_planes], heights[max_planes];
+    int job_count = 0;
 
     for (int p = 0; p < in_vi.Format.Planes; p++)
     {
@@ -180,31 +376,186 @@ struct MiniDeen : Filter {
         width >>= in_vi.Format.SSW;
       }
 
-      if (process[p] == 2) {
-        framecpy(dst_ptr, dst_stride, src_ptr, src_stride, width * in_vi.Format.BytesPerSample, height);
+      if (process[p] == 2 && scale == 2) {
+        if (in_vi.Format.BytesPerSample == 1)
+          framedecimate<uint8_t>(dst_ptr, dst_stride, src_ptr, src_stride, width / 2, height / 2);
+        else
+          framedecimate<uint16_t>(dst_ptr, dst_stride, src_ptr, src_stride, width / 2, height / 2);
         continue;
       }
       if (process[p] != 3)
         continue;
 
-      minideen_core(src_ptr, dst_ptr, width, height, src_stride, dst_stride, threshold[p], radius[p]);
+      auto &job = jobs[job_count];
+      job = PlaneJob {src_ptr, dst_ptr, src_stride, dst_stride, static_cast<unsigned>(threshold[p]), &neighbourhood[p]};
+      job.threshold_hi = threshold_hi[p];
+      job.scale = scale;
+      job.approximate = approximate;
+      job.median = median;
+      if (chroma && guide_luma) {
+        job.guidep = src.SrcPointers[0];
+        job.guide_stride = src.StrideBytes[0];
+        job.guide_threshold = guide_threshold;
+        job.guide_ssw = in_vi.Format.SSW;
+        job.guide_ssh = in_vi.Format.SSH;
+      }
+      widths[job_count] = width;
+      heights[job_count] = height;
+      job_count++;
     }
 
+    process_planes(jobs, widths, heights, job_count);
+    if (pyramid)
+      process_pyramid(jobs, widths, heights, job_count);
+
     return dst;
   }
 
-  void framecpy(unsigned char * dst_ptr, int dst_stride, const unsigned char * src_ptr, int src_stride, int width_byte, int height) {
-    if (src_stride == dst_stride) {
-      memcpy(dst_ptr, src_ptr, dst_stride * height);
-      return;
+  void process_planes(const PlaneJob *jobs, const int *widths, const int *heights, int count) {
+    PlaneJob field_jobs[max_planes];
+    int field_heights[max_planes];
+    int field_count = fields ? 2 : 1;
+
+    for (int f = 0; f < field_count; f++) {
+      // Each field is every other line of the frame, so run it with doubled strides.
+      for (int i = 0; i < count; i++) {
+        field_jobs[i] = jobs[i];
+        field_jobs[i].srcp += f * jobs[i].src_stride;
+        field_jobs[i].dstp += f * jobs[i].dst_stride;
+        field_jobs[i].src_stride *= field_count;
+        field_jobs[i].dst_stride *= field_count;
+        if (jobs[i].guidep) {
+          field_jobs[i].guidep += f * jobs[i].guide_stride;
+          field_jobs[i].guide_stride *= field_count;
+        }
+        field_heights[i] = (heights[i] + field_count - 1 - f) / field_count;
+      }
+
+      // With guide=luma, luma and chroma rows are run in bands so the
+      // luma rows read as guide are still in cache from the luma pass.
+      // Bands count output rows, which are fewer than source rows at scale=2.
+      int luma_height = (in_vi.Height / scale + field_count - 1 - f) / field_count;
+      int band = guide_luma ? 16 << in_vi.Format.SSH : luma_height;
+
+      // With threads, the rows are split in slices of whole bands of at
+      // least 64 rows, run on the shared pool.
+      int unit = 16 << in_vi.Format.SSH;
+      int slices = std::max(std::min(threads, luma_height / 64), 1);
+      int slice_height = ((luma_height + slices - 1) / slices + unit - 1) / unit * unit;
+      slices = (luma_height + slice_height - 1) / slice_height;
+
+      pool_run(slices, [&](int s) {
+        int s0 = s * slice_height;
+        int s1 = std::min(s0 + slice_height, luma_height);
+
+        // Planes of the same size (U and V, or all planes of 4:4:4) go
+        // through the kernel in one sweep, streamed over the slice's rows.
+        std::vector<RowStream> streams;
+        int shifts[max_planes];
+        for (int first = 0, last; first < count; first = last) {
+          for (last = first + 1; last < count; last++)
+            if (widths[last] != widths[first] || heights[last] != heights[first])
+              break;
+          int shift = heights[first] == in_vi.Height ? 0 : in_vi.Format.SSH;
+          int out_height = field_heights[first] / scale;
+          int group_y0 = std::min(s0 >> shift, out_height);
+          int group_y1 = s1 == luma_height ? out_height : std::min(s1 >> shift, out_height);
+          shifts[streams.size()] = shift;
+          streams.emplace_back(minideen_core, field_jobs + first, last - first, widths[first], field_heights[first], band >> shift, nullptr, group_y0, group_y1);
+        }
+
+        // The source rows are all there, but handing them over a band at a
+        // time interleaves the sweeps.
+        for (int y1 = std::min(s0 + band, s1); ; y1 = std::min(y1 + band, s1)) {
+          for (size_t g = 0; g < streams.size(); g++)
+            streams[g].push(y1 == s1 ? INT_MAX : (y1 >> shifts[g]) * scale);
+          if (y1 == s1)
+            break;
+        }
+      });
     }
+  }
+
+  // Scratch buffers are pooled so every frame in flight takes its own and
+  // returns it for the next one.
+  std::vector<uint8_t> take_scratch() {
+    std::vector<uint8_t> scratch;
+    std::lock_guard<std::mutex> guard(scratch_mutex);
+    if (!scratch_pool.empty()) {
+      scratch = std::move(scratch_pool.back());
+      scratch_pool.pop_back();
+    }
+    return scratch;
+  }
+
+  void give_scratch(std::vector<uint8_t> &&scratch) {
+    std::lock_guard<std::mutex> guard(scratch_mutex);
+    scratch_pool.push_back(std::move(scratch));
+  }
+
+  // Pyramid mode: filter a half resolution copy of each plane with the same
+  // neighbourhood and add the upsampled correction to the full resolution
+  // result, so coarse grain is reached at the cost of a small radius.
+  void process_pyramid(const PlaneJob *jobs, const int *widths, const int *heights, int count) {
+    auto scratch = take_scratch();
+
+    // Two low planes per job, with a padding row above and below and
+    // padded strides, as the kernels read and write past the plane width.
+    int low_strides[max_planes];
+    size_t low_sizes[max_planes], total = 64;
+    for (int i = 0; i < count; i++) {
+      int low_width = (widths[i] + 1) / 2, low_height = (heights[i] + 1) / 2;
+      low_strides[i] = ((low_width * in_vi.Format.BytesPerSample + 63) & ~63) + 64;
+      low_sizes[i] = static_cast<size_t>(low_strides[i]) * (low_height + 2);
+      total += low_sizes[i] * 2;
+    }
+    if (scratch.size() < total)
+      scratch.resize(total);
+    auto base = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(scratch.data()) + 63) & ~static_cast<uintptr_t>(63));
+
+    for (int i = 0; i < count; i++) {
+      int low_width = (widths[i] + 1) / 2, low_height = (heights[i] + 1) / 2;
+      uint8_t *low = base + low_strides[i];
+      uint8_t *filtered = low + low_sizes[i];
+      base += low_sizes[i] * 2;
+
+      PlaneJob job = jobs[i];
+      job.srcp = low;
+      job.dstp = filtered;
+      job.src_stride = job.dst_stride = low_strides[i];
+      job.guidep = nullptr;
+
+      if (in_vi.Format.BytesPerSample == 1) {
+        pyramid_reduce<uint8_t>(jobs[i].srcp, jobs[i].src_stride, low, low_strides[i], widths[i], heights[i]);
+        minideen_core(&job, 1, low_width, low_height, 0, low_height);
+        pyramid_expand<uint8_t>(jobs[i].dstp, jobs[i].dst_stride, low, filtered, low_strides[i], widths[i], heights[i], pixel_max);
+      }
+      else {
+        pyramid_reduce<uint16_t>(jobs[i].srcp, jobs[i].src_stride, low, low_strides[i], widths[i], heights[i]);
+        minideen_core(&job, 1, low_width, low_height, 0, low_height);
+        pyramid_expand<uint16_t>(jobs[i].dstp, jobs[i].dst_stride, low, filtered, low_strides[i], widths[i], heights[i], pixel_max);
+      }
+    }
+
+    give_scratch(std::move(scratch));
+  }
+
+  // Point sample planes that are copied at scale=2.
+  template <typename PixelType>
+  void framedecimate(unsigned char * dst_ptr, int dst_stride, const unsigned char * src_ptr, int src_stride, int width, int height) {
     for (int h = 0; h < height; h++)
     {
-      memcpy(dst_ptr, src_ptr, width_byte);
-      dst_ptr += dst_stride;
-      src_ptr += src_stride;
+      auto srcp = reinterpret_cast<const PixelType *>(src_ptr + h * 2 * src_stride);
+      auto dstp = reinterpret_cast<PixelType *>(dst_ptr + h * dst_stride);
+      for (int w = 0; w < width; w++)
+        dstp[w] = srcp[w * 2];
     }
   }
 
-  ~MiniDeen() = default;
+  // Hosts free filters before they unload the plugin, so the last
+  // instance joins the pool's workers here.
+  ~MiniDeen() {
+    if (pooled)
+      pool_release();
+  }
 };
@@ -1,15 +1,190 @@
+#pragma once
+
 #include <cstdint>
+#include <cstdlib>
+#include <algorithm>
 #include <immintrin.h>
 
+static constexpr int max_radius {7};
+static constexpr int max_planes {4};
+static constexpr int max_taps {(max_radius * 2 + 1) * (max_radius * 2 + 1)};
+// Widest median sorting network, and its comparator count before pruning.
+static constexpr int max_network_width {32};
+static constexpr int max_network_size {191};
+
 enum PathType {
   Slow, Fast
 };
 
+enum ShapeType {
+  Square, Cross, Diamond
+};
+
+// Horizontal step between co-sited guide samples, by chroma subsampling.
+enum GuideType {
+  Unguided, GuideFull, GuideHalf, GuideQuarter
+};
+
+// How the elements swept by a kernel sit in memory: a planar row, the U/V
+// pairs of a semi-planar chroma plane, the luma or chroma bytes of YUY2, or
+// every other sample of a planar row when decimating.
+enum SampleLayout {
+  Planar, Interleaved, PackedLuma, PackedChroma, Decimated
+};
+
+// Memory elements from one kernel element to the next and from one
+// horizontal tap to the next, and border check entries per tap.
+static constexpr int sample_pitch(SampleLayout sl) { return sl == Planar || sl == Interleaved ? 1 : 2; }
+static constexpr int tap_offset(SampleLayout sl) { return sl == Planar || sl == Decimated ? 1 : sl == PackedChroma ? 4 : 2; }
+static constexpr int tap_step(SampleLayout sl) { return sl == Interleaved || sl == PackedChroma ? 2 : 1; }
+
+// What the accepted taps are reduced to. SoftMean also takes taps below the
+// high threshold with half weight.
+enum AverageType {
+  Mean, SoftMean, Median
+};
+
+enum PlaneLayout {
+  LayoutPlanar, LayoutSemiPlanar, LayoutYUY2
+};
+
+// Tap list of a neighbourhood, stored row by row as the horizontal
+// half-width of every row from -radius_v to radius_v. A sparse neighbourhood
+// only keeps the taps with xx + yy even, a checkerboard with half the taps.
+struct Neighbourhood {
+  int radius_h {1}, radius_v {1};
+  int span[max_radius * 2 + 1] {};
+  bool sparse {false};
+  // Median selection network over network_width inputs, pruned to the
+  // comparators that reach output network_width / 2 - 1. Width 0 when there
+  // are too many taps, which are counted instead.
+  int network_width {0}, network_size {0};
+  uint8_t network[max_network_size][2] {};
+
+  // First tap of a row, counted from -span.
+  int first(int yy) const { return sparse ? (yy - span[yy + radius_v]) & 1 : 0; }
+
+  int taps() const {
+    int count = 0;
+    for (int yy = -radius_v; yy <= radius_v; yy++)
+      count += (span[yy + radius_v] * 2 - first(yy)) / (1 + sparse) + 1;
+    return count;
+  }
+
+  // Batcher's odd-even merge sort over the next power of two above the tap
+  // count, keeping only the comparators the median output depends on.
+  void build_network() {
+    network_width = network_size = 0;
+    int n = 2;
+    while (n <= taps())
+      n <<= 1;
+    if (n > max_network_width)
+      return;
+
+    uint8_t all[max_network_size][2];
+    int all_size = 0;
+    for (int p = 1; p < n; p <<= 1)
+      for (int k = p; k >= 1; k >>= 1)
+        for (int j = k % p; j + k < n; j += 2 * k)
+          for (int i = 0; i < std::min(k, n - j - k); i++)
+            if ((i + j) / (p * 2) == (i + j + k) / (p * 2)) {
+              all[all_size][0] = i + j;
+              all[all_size][1] = i + j + k;
+              all_size++;
+            }
+
+    bool live[max_network_width] {};
+    live[n / 2 - 1] = true;
+    bool keep[max_network_size] {};
+    for (int c = all_size - 1; c >= 0; c--)
+      if (live[all[c][0]] || live[all[c][1]])
+        keep[c] = live[all[c][0]] = live[all[c][1]] = true;
+    for (int c = 0; c < all_size; c++)
+      if (keep[c]) {
+        network[network_size][0] = all[c][0];
+        network[network_size][1] = all[c][1];
+        network_size++;
+      }
+    network_width = n;
+  }
+
+  Neighbourhood() : Neighbourhood(Square, 1, 1) {}
+  Neighbourhood(ShapeType shape, int rh, int rv) : radius_h(rh), radius_v(rv) {
+    for (int yy = -rv; yy <= rv; yy++) {
+      switch (shape) {
+        case Square: span[yy + rv] = rh; break;
+        case Cross: span[yy + rv] = yy == 0 ? rh : 0; break;
+        case Diamond: span[yy + rv] = rh * (rv - std::abs(yy)) / (rv > 0 ? rv : 1); break;
+      }
+    }
+  }
+};
+
+// A plane handed to the kernels. Planes passed together share one geometry
+// and are swept row by row in a single pass.
+struct PlaneJob {
+  const uint8_t *srcp;
+  uint8_t *dstp;
+  int src_stride, dst_stride;
+  unsigned threshold;
+  const Neighbourhood *nb;
+  // Luma plane guiding a chroma plane, read at (x << guide_ssw, y << guide_ssh).
+  const uint8_t *guidep {nullptr};
+  int guide_stride {0};
+  unsigned guide_threshold {0};
+  int guide_ssw {0}, guide_ssh {0};
+  // Interleaved layouts. A semi-planar job is the UV plane of NV12/P010 with
+  // its width counted in U/V pairs. A YUY2 job is the whole packed plane with
+  // its width counted in luma samples, threshold and nb applying to Y.
+  PlaneLayout layout {LayoutPlanar};
+  unsigned chroma_threshold[2] {0, 0};
+  const Neighbourhood *chroma_nb {nullptr};
+  bool filter_luma {true};
+  bool filter_chroma[2] {true, true};
+  // Soft threshold: taps below threshold get full weight and taps below
+  // threshold_hi half weight; threshold_hi up to threshold is a hard one.
+  unsigned threshold_hi {0};
+  unsigned chroma_threshold_hi[2] {0, 0};
+  // Output every scale-th sample of every scale-th row; width, height and
+  // the swept rows stay in source units, dst rows in output units.
+  int scale {1};
+  // Divide with the raw reciprocal estimate instead of the refined one.
+  bool approximate {false};
+  // Output the lower median of the accepted taps instead of their average.
+  bool median {false};
+
+  bool soft() const { return threshold_hi > threshold; }
+  bool chroma_soft() const { return chroma_threshold_hi[0] > chroma_threshold[0] || chroma_threshold_hi[1] > chroma_threshold[1]; }
+  AverageType average() const { return median ? Median : soft() ? SoftMean : Mean; }
+  AverageType chroma_average() const { return median ? Median : chroma_soft() ? SoftMean : Mean; }
+};
+
+// Collect the guide samples co-sited with elements x_from .. x_from + count - 1
+// of a block, zeroing those outside the plane.
 template <typename PixelType>
-void minideen_C(const uint8_t *, uint8_t *, int, int, int, int, unsigned int, int);
+static inline void gather_guide(PixelType *out, const PixelType *guidep, int shift, int x_from, int count, int diff_l, int diff_r) {
+  for (int i = 0; i < count; i++)
+    out[i] = (x_from + i >= -diff_l && x_from + i < diff_r) ? guidep[(x_from + i) << shift] : 0;
+}
 
-void minideen_SSE2_8(const uint8_t *, uint8_t *, int, int, int, int, unsigned int, int);
-void minideen_SSE2_16(const uint8_t *, uint8_t *, int, int, int, int, unsigned int, int);
+template <typename PixelType>
+void minideen_C(const PlaneJob *, int, int, int, int, int);
+
+void minideen_SSE2_8(const PlaneJob *, int, int, int, int, int);
+void minideen_SSE2_16(const PlaneJob *, int, int, int, int, int);
+
+void minideen_AVX2_8(const PlaneJob *, int, int, int, int, int);
+void minideen_AVX2_16(const PlaneJob *, int, int, int, int, int);
+
+typedef void (*MiniDeenKernel)(const PlaneJob *, int, int, int, int, int);
 
-void minideen_AVX2_8(const uint8_t *, uint8_t *, int, int, int, int, unsigned int, int);
-void minideen_AVX2_16(const uint8_t *, uint8_t *, int, int, int, int, unsigned int, int);
+// The fastest kernel for the sample size that the CPU runs, up to opt:
+// 0 auto, 1 C, 2 SSE2, 3 AVX2.
+MiniDeenKernel minideen_kernel(int bytes_per_sample, int opt);
+
+// Half resolution planes of pyramid mode: a 2x2 box reduce, and adding the
+// upsampled difference between the filtered and unfiltered low planes.
+template <typename PixelType>
+void pyramid_reduce(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height);
+template <typename PixelType>
+void pyramid_expand(uint8_t *dstp, int dst_stride, const uint8_t *lowp, const uint8_t *filteredp, int low_stride, int width, int height, int pixel_max);
@@ -1,38 +1,102 @@
 #include "minideen_common.h"
 #include <algorithm>
 
-template <typename PixelType>
-void minideen_C(const uint8_t *srcp8, uint8_t *dstp8, int width, int height, int src_stride, int dst_stride, unsigned threshold, int radius) {
-  const PixelType *srcp = (const PixelType *)srcp8;
-  PixelType *dstp = (PixelType *)dstp8;
-  src_stride /= sizeof(PixelType);
-  dst_stride /= sizeof(PixelType);
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      unsigned center_pixel = srcp[x];
-
-      unsigned sum = center_pixel * 2;
-      unsigned counter = 2;
-
-      for (int yy = std::max(-y, -radius); yy <= std::min(radius, height - y - 1); yy++) {
-        for (int xx = std::max(-x, -radius); xx <= std::min(radius, width - x - 1); xx++) {
-          unsigned neighbour_pixel = srcp[x + yy * src_stride + xx];
-
-          if (threshold > (unsigned)std::abs((int)center_pixel - (int)neighbour_pixel)) {
-            counter++;
-            sum += neighbour_pixel;
-          }
+template <typename PixelType, SampleLayout sl>
+static void row_C(const PixelType *srcp, PixelType *dstp, int y, int width, int height, int src_stride, const unsigned threshold[2], const unsigned threshold_hi[2], const bool filter[2], bool median, const Neighbourhood &nb,
+                  const PixelType *guidep, int guide_stride, int guide_ssw, unsigned guide_threshold) {
+  constexpr int pitch = sample_pitch(sl);
+  constexpr int phase = sl == PackedChroma ? 1 : 0;
+  constexpr int offset = tap_offset(sl);
+  constexpr int dst_pitch = sl == Decimated ? 1 : pitch;
+
+  // Taps are bounded in memory units, so every layout shares one border check.
+  // Interleaved chroma alternates U and V, which take their own thresholds.
+  for (int x = 0; x < width; x++) {
+    int pos = x * pitch;
+    unsigned center_pixel = srcp[pos + phase];
+    if (!filter[x & 1]) {
+      dstp[x * dst_pitch + phase] = center_pixel;
+      continue;
+    }
+
+    // Weights are counted in halves: 2 below threshold, 1 below threshold_hi.
+    unsigned sum = center_pixel * 4;
+    unsigned counter = 4;
+
+    // The centre is one of the taps, so the median never runs out of them.
+    PixelType taps[max_taps];
+    int n = 0;
+
+    for (int yy = std::max(-y, -nb.radius_v); yy <= std::min(nb.radius_v, height - y - 1); yy++) {
+      int span = nb.span[yy + nb.radius_v];
+      int xx_l = std::max(-pos / offset, -span), xx_r = std::min(span, (width * pitch - pos - 1) / offset);
+      for (int xx = -span + nb.first(yy); xx <= xx_r; xx += 1 + nb.sparse) {
+        if (xx < xx_l)
+          continue;
+        unsigned neighbour_pixel = srcp[pos + xx * offset + phase + yy * src_stride];
+
+        unsigned diff = std::abs((int)center_pixel - (int)neighbour_pixel);
+        unsigned weight = threshold[x & 1] > diff ? 2 : threshold_hi[x & 1] > diff ? 1 : 0;
+        if (guidep) {
+          // Chroma taps are only accepted where the co-sited luma is similar as well.
+          int guide_center = guidep[x << guide_ssw];
+          int guide_neighbour = guidep[yy * guide_stride + ((x + xx) << guide_ssw)];
+          if (guide_threshold <= (unsigned)std::abs(guide_center - guide_neighbour))
+            weight = 0;
         }
-      }
 
-      dstp[x] = (sum * 2 + counter) / (counter * 2);
+        counter += weight;
+        sum += neighbour_pixel * weight;
+        if (median && weight)
+          taps[n++] = neighbour_pixel;
+      }
     }
 
-    srcp += src_stride;
-    dstp += dst_stride;
+    if (median) {
+      // Lower median of the accepted taps.
+      std::nth_element(taps, taps + (n - 1) / 2, taps + n);
+      dstp[x * dst_pitch + phase] = taps[(n - 1) / 2];
+    }
+    else
+      dstp[x * dst_pitch + phase] = (sum * 2 + counter) / (counter * 2);
   }
 }
 
-template void minideen_C<uint8_t>(const uint8_t *, uint8_t *, int, int, int, int, unsigned, int);
-template void minideen_C<uint16_t>(const uint8_t *, uint8_t *, int, int, int, int, unsigned, int);
+template <typename PixelType>
+void minideen_C(const PlaneJob *jobs, int count, int width, int height, int y0, int y1) {
+  for (int y = y0; y < y1; y++)
+    for (int i = 0; i < count; i++) {
+      const PlaneJob &job = jobs[i];
+      int sy = y * job.scale;
+      auto srcp = (const PixelType *)(job.srcp + sy * job.src_stride);
+      auto dstp = (PixelType *)(job.dstp + y * job.dst_stride);
+      int src_stride = job.src_stride / sizeof(PixelType);
+      const unsigned threshold[2] {job.threshold, job.threshold};
+      const unsigned threshold_hi[2] {job.threshold_hi, job.threshold_hi};
+      const bool filter[2] {job.filter_luma, job.filter_luma};
+
+      if (job.scale == 2) {
+        row_C<PixelType, Decimated>(srcp, dstp, sy, width / 2, height, src_stride, threshold, threshold_hi, filter, job.median, *job.nb, nullptr, 0, 0, 0);
+        continue;
+      }
+
+      switch (job.layout) {
+        case LayoutPlanar: {
+          const PixelType *guidep = job.guidep ? (const PixelType *)(job.guidep + (y << job.guide_ssh) * job.guide_stride) : nullptr;
+          row_C<PixelType, Planar>(srcp, dstp, y, width, height, src_stride, threshold, threshold_hi, filter, job.median, *job.nb,
+                                   guidep, (job.guide_stride << job.guide_ssh) / sizeof(PixelType), job.guide_ssw, job.guide_threshold);
+          break;
+        }
+        case LayoutSemiPlanar:
+          row_C<PixelType, Interleaved>(srcp, dstp, y, width * 2, height, src_stride, job.chroma_threshold, job.chroma_threshold_hi, job.filter_chroma, job.median, *job.chroma_nb, nullptr, 0, 0, 0);
+          break;
+        case LayoutYUY2:
+          row_C<PixelType, PackedLuma>(srcp, dstp, y, width, height, src_stride, threshold, threshold_hi, filter, job.median, *job.nb, nullptr, 0, 0, 0);
+          row_C<PixelType, PackedChroma>(srcp, dstp, y, width, height, src_stride, job.chroma_threshold, job.chroma_threshold_hi, job.filter_chroma, job.median, *job.chroma_nb, nullptr, 0, 0, 0);
+          break;
+      }
+    }
+}
+
+template void minideen_C<uint8_t>(const PlaneJob *, int, int, int, int, int);
+template void minideen_C<uint16_t>(const PlaneJob *, int, int, int, int, int);
@@ -9,17 +9,134 @@ __m128 _mm_rcpnr_ps(const __m128 &a) {
   return _mm_sub_ps(_mm_add_ps(r, r), _mm_mul_ps(_mm_mul_ps(r, a), r));
 }
 
-template <PathType pt>
-static void core_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int stride, __m128i &bytes_th, int diff_l, int diff_r, int radius) {
+// Keep the even elements of a followed by the even elements of b.
+static inline __m128i even_8(const __m128i &a, const __m128i &b) {
+  const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+  return _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes));
+}
+
+// Keep the odd elements of a followed by the odd elements of b.
+static inline __m128i odd_8(const __m128i &a, const __m128i &b) {
+  return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static inline __m128i even_16(const __m128i &a, const __m128i &b) {
+  // Sign extend so the signed pack keeps the bit pattern.
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+template <GuideType gt, typename PixelType>
+static inline __m128i load_guide(const PixelType *p) {
+  constexpr int n = sizeof(__m128i) / sizeof(PixelType);
+  auto even = [](const __m128i &a, const __m128i &b) {
+    return sizeof(PixelType) == 1 ? even_8(a, b) : even_16(a, b);
+  };
+  __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+  if constexpr (gt == GuideFull)
+    return v0;
+  __m128i v1 = _mm_loadu_si128((const __m128i *)(p + n));
+  if constexpr (gt == GuideHalf)
+    return even(v0, v1);
+  __m128i v2 = _mm_loadu_si128((const __m128i *)(p + n * 2));
+  __m128i v3 = _mm_loadu_si128((const __m128i *)(p + n * 3));
+  return even(even(v0, v1), even(v2, v3));
+}
+
+// Load 16 kernel elements, splitting the luma or chroma bytes out of YUY2
+// or taking every other sample when decimating.
+template <SampleLayout sl>
+static inline __m128i load_8(const uint8_t *p) {
+  __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+  if constexpr (sl == Planar || sl == Interleaved)
+    return v0;
+  __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+  return sl == PackedChroma ? odd_8(v0, v1) : even_8(v0, v1);
+}
+
+// Load 8 kernel elements, taking every other sample when decimating.
+template <SampleLayout sl>
+static inline __m128i load_16(const uint16_t *p) {
+  __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+  if constexpr (sl != Decimated)
+    return v0;
+  __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 8));
+  return even_16(v0, v1);
+}
+
+// Keep the lanes of src selected by keep and take the rest from result.
+static inline __m128i blend(const __m128i &keep, const __m128i &src, const __m128i &result) {
+  return _mm_or_si128(_mm_and_si128(keep, src), _mm_andnot_si128(keep, result));
+}
+
+// SSE2 has no unsigned 16 bit min and max.
+static inline __m128i min_epu16(const __m128i &a, const __m128i &b) {
+  return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+static inline __m128i max_epu16(const __m128i &a, const __m128i &b) {
+  return _mm_add_epi16(b, _mm_subs_epu16(a, b));
+}
+
+// Lower median of n taps, n odd. Small neighbourhoods go through the sorting
+// network, padded with as many zeroes below as all ones above the taps.
+// Larger ones build the median bit by bit from the top, keeping a bit while
+// more than half of the taps are at or above the candidate.
+template <typename PixelType>
+static __m128i select_median(__m128i *taps, int n, const Neighbourhood &nb) {
+  constexpr bool wide = sizeof(PixelType) == 2;
+  auto min = [](const __m128i &a, const __m128i &b) { return wide ? min_epu16(a, b) : _mm_min_epu8(a, b); };
+  auto max = [](const __m128i &a, const __m128i &b) { return wide ? max_epu16(a, b) : _mm_max_epu8(a, b); };
+  auto set1 = [](int v) { return wide ? _mm_set1_epi16(v) : _mm_set1_epi8(v); };
+
+  if (nb.network_width) {
+    int width = nb.network_width;
+    for (int i = n; i < width; i++)
+      taps[i] = i < n + (width - n - 1) / 2 ? zeroes : _mm_cmpeq_epi8(zeroes, zeroes);
+    for (int c = 0; c < nb.network_size; c++) {
+      __m128i &a = taps[nb.network[c][0]], &b = taps[nb.network[c][1]];
+      __m128i low = min(a, b);
+      b = max(a, b);
+      a = low;
+    }
+    return taps[width / 2 - 1];
+  }
+
+  __m128i need = set1(n - (n - 1) / 2);
+  __m128i result = zeroes;
+  for (int bit = sizeof(PixelType) * 8 - 1; bit >= 0; bit--) {
+    __m128i candidate = _mm_or_si128(result, set1(1 << bit));
+    // Subtract all ones aka -1 for every tap at or above the candidate.
+    __m128i count = zeroes;
+    for (int i = 0; i < n; i++) {
+      if constexpr (wide)
+        count = _mm_sub_epi16(count, _mm_cmpeq_epi16(_mm_subs_epu16(candidate, taps[i]), zeroes));
+      else
+        count = _mm_sub_epi8(count, _mm_cmpeq_epi8(_mm_subs_epu8(candidate, taps[i]), zeroes));
+    }
+    __m128i keep = wide ? _mm_cmpeq_epi16(_mm_subs_epu16(need, count), zeroes) : _mm_cmpeq_epi8(_mm_subs_epu8(need, count), zeroes);
+    result = _mm_or_si128(result, _mm_and_si128(keep, set1(1 << bit)));
+  }
+  return result;
+}
+
+template <PathType pt, GuideType gt, SampleLayout sl, AverageType at>
+static __m128i core_8(const uint8_t *srcp, int y, int height, int stride, const __m128i *bytes_th, int diff_l, int diff_r, const Neighbourhood &nb, const uint8_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate) {
+  constexpr int guide_shift = gt == Unguided ? 0 : gt - GuideFull;
+  constexpr int step = tap_step(sl);
+  constexpr int offset = tap_offset(sl);
+  // Decimated lanes sit on every other source sample, border flags on every sample.
+  constexpr int border_pitch = sl == Decimated ? 2 : 1;
+  const int reach = nb.radius_h * step;
+
   alignas(64) uint8_t border_check[64] = {};
 
   if constexpr (pt == Slow) {
     for (int i = 0; i < 64; i++)
-      if (i - radius >= -diff_l && i - radius < diff_r)
+      if (i - reach >= -diff_l * border_pitch && i - reach < diff_r * border_pitch)
         border_check[i] = 0xFF;
   }
 
-  __m128i center_pixel = _mm_load_si128((const __m128i *)srcp);
+  __m128i center_pixel = load_8<sl>(srcp);
 
   __m128i center_lo = _mm_unpacklo_epi8(center_pixel, zeroes);
   __m128i center_hi = _mm_unpackhi_epi8(center_pixel, zeroes);
@@ -29,25 +146,71 @@ static void core_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int st
 
   __m128i counter = _mm_set1_epi8(2);
 
-  int yyT = std::max(-y, -radius);
-  int yyB = std::min(radius, height - y - 1);
+  // Soft threshold: taps below bytes_th[1] are summed a second time, so those
+  // also below bytes_th[0] weigh twice as much.
+  __m128i soft_sum_lo = sum_lo, soft_sum_hi = sum_hi, soft_counter = counter;
+
+  // Median: the taps in scan order, rejected ones filled alternately with
+  // 0 and all ones so the lower median of the accepted ones stays in the
+  // middle. Taps outside the frame are rejected.
+  __m128i taps[max_taps + 1];
+  __m128i fill = zeroes;
+  int n = 0;
+
+  alignas(64) uint8_t guide_row[16 + max_radius * 2];
+  __m128i guide_center = zeroes;
+  if constexpr (gt != Unguided) {
+    if constexpr (pt == Slow) {
+      gather_guide(guide_row, guidep, guide_shift, 0, 16, diff_l, diff_r);
+      guide_center = _mm_load_si128((const __m128i *)guide_row);
+    }
+    else
+      guide_center = load_guide<gt>(guidep);
+  }
+
+  int yyT = std::max(-y, -nb.radius_v);
+  int yyB = std::min(nb.radius_v, height - y - 1);
 
   for (int yy = yyT; yy <= yyB; yy++) {
-    for (int xx = -radius; xx <= radius; xx++) {
-      __m128i neighbour_pixel = _mm_loadu_si128((const __m128i *)(srcp + yy * stride + xx));
+    int span = nb.span[yy + nb.radius_v];
+    if constexpr (gt != Unguided && pt == Slow)
+      gather_guide(guide_row, guidep + yy * guide_stride, guide_shift, -span, 16 + span * 2, diff_l, diff_r);
+    for (int xx = -span + nb.first(yy); xx <= span; xx += 1 + nb.sparse) {
+      __m128i neighbour_pixel = load_8<sl>(srcp + yy * stride + xx * offset);
 
       __m128i abs_diff = _mm_or_si128(_mm_subs_epu8(center_pixel, neighbour_pixel),
                       _mm_subs_epu8(neighbour_pixel, center_pixel));
 
       // Absolute difference less than or equal to th - 1 will be all zeroes.
-      abs_diff = _mm_subs_epu8(abs_diff, bytes_th);
-
       // 0 bytes become 255, not 0 bytes become 0.
-      __m128i mask = _mm_cmpeq_epi8(abs_diff, zeroes);
+      __m128i mask = _mm_cmpeq_epi8(_mm_subs_epu8(abs_diff, bytes_th[0]), zeroes);
+      __m128i soft_mask = at == SoftMean ? _mm_cmpeq_epi8(_mm_subs_epu8(abs_diff, bytes_th[1]), zeroes) : zeroes;
+
+      if constexpr (gt != Unguided) {
+        // Chroma taps are only accepted where the co-sited luma is similar as well.
+        __m128i guide_pixel;
+        if constexpr (pt == Slow)
+          guide_pixel = _mm_loadu_si128((const __m128i *)(guide_row + span + xx));
+        else
+          guide_pixel = load_guide<gt>(guidep + yy * guide_stride + (xx << guide_shift));
+        __m128i guide_diff = _mm_or_si128(_mm_subs_epu8(guide_center, guide_pixel),
+                        _mm_subs_epu8(guide_pixel, guide_center));
+        __m128i guide_mask = _mm_cmpeq_epi8(_mm_subs_epu8(guide_diff, guide_th), zeroes);
+        mask = _mm_and_si128(mask, guide_mask);
+        soft_mask = _mm_and_si128(soft_mask, guide_mask);
+      }
 
       if constexpr (pt == Slow) {
-        __m128i m_border_check = _mm_loadu_si128((const __m128i *)(border_check+radius+xx));
+        __m128i m_border_check = load_8<sl == Decimated ? PackedLuma : Planar>(border_check + reach + xx * step);
         mask = _mm_and_si128(mask, m_border_check);
+        soft_mask = _mm_and_si128(soft_mask, m_border_check);
+      }
+
+      if constexpr (at == Median) {
+        __m128i rejected = _mm_cmpeq_epi8(mask, zeroes);
+        taps[n++] = _mm_or_si128(_mm_and_si128(mask, neighbour_pixel), _mm_and_si128(rejected, fill));
+        fill = _mm_xor_si128(fill, rejected);
+        continue;
       }
 
       // Subtract 255 aka -1
@@ -59,11 +222,32 @@ static void core_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int st
                   _mm_unpacklo_epi8(pixels, zeroes));
       sum_hi = _mm_adds_epu16(sum_hi,
                   _mm_unpackhi_epi8(pixels, zeroes));
+
+      if constexpr (at == SoftMean) {
+        soft_counter = _mm_sub_epi8(soft_counter, soft_mask);
+        __m128i soft_pixels = _mm_and_si128(soft_mask, neighbour_pixel);
+        soft_sum_lo = _mm_adds_epu16(soft_sum_lo, _mm_unpacklo_epi8(soft_pixels, zeroes));
+        soft_sum_hi = _mm_adds_epu16(soft_sum_hi, _mm_unpackhi_epi8(soft_pixels, zeroes));
+      }
     }
   }
 
+  if constexpr (at == Median) {
+    // Rows outside the frame are left out, so even counts take one more
+    // rejected tap.
+    if (!(n & 1))
+      taps[n++] = fill;
+    return select_median<uint8_t>(taps, n, nb);
+  }
+
   __m128i counter_lo = _mm_unpacklo_epi8(counter, zeroes);
   __m128i counter_hi = _mm_unpackhi_epi8(counter, zeroes);
+  if constexpr (at == SoftMean) {
+    counter_lo = _mm_add_epi16(counter_lo, _mm_unpacklo_epi8(soft_counter, zeroes));
+    counter_hi = _mm_add_epi16(counter_hi, _mm_unpackhi_epi8(soft_counter, zeroes));
+  }
+
+  auto rcp = [approximate](const __m128 &a) { return approximate ? _mm_rcp_ps(a) : _mm_rcpnr_ps(a); };
 
   __m128 counter_1 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(counter_lo, zeroes));
   __m128 counter_2 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(counter_lo, zeroes));
@@ -74,11 +258,17 @@ static void core_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int st
   __m128 sum_2 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sum_lo, zeroes));
   __m128 sum_3 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(sum_hi, zeroes));
   __m128 sum_4 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sum_hi, zeroes));
+  if constexpr (at == SoftMean) {
+    sum_1 = _mm_add_ps(sum_1, _mm_cvtepi32_ps(_mm_unpacklo_epi16(soft_sum_lo, zeroes)));
+    sum_2 = _mm_add_ps(sum_2, _mm_cvtepi32_ps(_mm_unpackhi_epi16(soft_sum_lo, zeroes)));
+    sum_3 = _mm_add_ps(sum_3, _mm_cvtepi32_ps(_mm_unpacklo_epi16(soft_sum_hi, zeroes)));
+    sum_4 = _mm_add_ps(sum_4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(soft_sum_hi, zeroes)));
+  }
 
-  __m128 resultf_1 = _mm_mul_ps(sum_1, _mm_rcpnr_ps(counter_1));
-  __m128 resultf_2 = _mm_mul_ps(sum_2, _mm_rcpnr_ps(counter_2));
-  __m128 resultf_3 = _mm_mul_ps(sum_3, _mm_rcpnr_ps(counter_3));
-  __m128 resultf_4 = _mm_mul_ps(sum_4, _mm_rcpnr_ps(counter_4));
+  __m128 resultf_1 = _mm_mul_ps(sum_1, rcp(counter_1));
+  __m128 resultf_2 = _mm_mul_ps(sum_2, rcp(counter_2));
+  __m128 resultf_3 = _mm_mul_ps(sum_3, rcp(counter_3));
+  __m128 resultf_4 = _mm_mul_ps(sum_4, rcp(counter_4));
 
   // Add 0.5f for rounding.
   resultf_1 = _mm_add_ps(resultf_1, _mm_set1_ps(0.501f));
@@ -94,20 +284,27 @@ static void core_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int st
   __m128i result_lo = _mm_packs_epi32(result_1, result_2);
   __m128i result_hi = _mm_packs_epi32(result_3, result_4);
 
-  _mm_store_si128((__m128i *)dstp, _mm_packus_epi16(result_lo, result_hi));
+  return _mm_packus_epi16(result_lo, result_hi);
 }
 
-template <PathType pt>
-static void core_16(const uint16_t *srcp, uint16_t *dstp, int y, int height, int stride, __m128i &words_th, int diff_l, int diff_r, int radius) {
+template <PathType pt, GuideType gt, SampleLayout sl, AverageType at>
+static __m128i core_16(const uint16_t *srcp, int y, int height, int stride, const __m128i *words_th, int diff_l, int diff_r, const Neighbourhood &nb, const uint16_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate) {
+  static_assert(sl != PackedLuma && sl != PackedChroma, "packed layouts are 8 bit only");
+  constexpr int guide_shift = gt == Unguided ? 0 : gt - GuideFull;
+  constexpr int step = tap_step(sl);
+  constexpr int offset = tap_offset(sl);
+  constexpr int border_pitch = sl == Decimated ? 2 : 1;
+  const int reach = nb.radius_h * step;
+
   alignas(64) uint16_t border_check[64] = {};
 
   if constexpr (pt == Slow) {
     for (int i = 0; i < 64; i++)
-      if (i - radius >= -diff_l && i - radius < diff_r)
+      if (i - reach >= -diff_l * border_pitch && i - reach < diff_r * border_pitch)
         border_check[i] = 0xFFFF;
   }
 
-  __m128i center_pixel = _mm_load_si128((const __m128i *)srcp);
+  __m128i center_pixel = load_16<sl>(srcp);
 
   __m128i center_lo = _mm_unpacklo_epi16(center_pixel, zeroes);
   __m128i center_hi = _mm_unpackhi_epi16(center_pixel, zeroes);
@@ -117,25 +314,71 @@ static void core_16(const uint16_t *srcp, uint16_t *dstp, int y, int height, int
 
   __m128i counter = _mm_set1_epi16(2);
 
-  int yyT = std::max(-y, -radius);
-  int yyB = std::min(radius, height - y - 1);
+  // Soft threshold: taps below words_th[1] are summed a second time, so those
+  // also below words_th[0] weigh twice as much.
+  __m128i soft_sum_lo = sum_lo, soft_sum_hi = sum_hi, soft_counter = counter;
+
+  // Median: the taps in scan order, rejected ones filled alternately with
+  // 0 and all ones so the lower median of the accepted ones stays in the
+  // middle. Taps outside the frame are rejected.
+  __m128i taps[max_taps + 1];
+  __m128i fill = zeroes;
+  int n = 0;
+
+  alignas(64) uint16_t guide_row[8 + max_radius * 2];
+  __m128i guide_center = zeroes;
+  if constexpr (gt != Unguided) {
+    if constexpr (pt == Slow) {
+      gather_guide(guide_row, guidep, guide_shift, 0, 8, diff_l, diff_r);
+      guide_center = _mm_load_si128((const __m128i *)guide_row);
+    }
+    else
+      guide_center = load_guide<gt>(guidep);
+  }
+
+  int yyT = std::max(-y, -nb.radius_v);
+  int yyB = std::min(nb.radius_v, height - y - 1);
 
   for (int yy = yyT; yy <= yyB; yy++) {
-    for (int xx = -radius; xx <= radius; xx++) {
-      __m128i neighbour_pixel = _mm_loadu_si128((const __m128i *)(srcp + yy * stride + xx));
+    int span = nb.span[yy + nb.radius_v];
+    if constexpr (gt != Unguided && pt == Slow)
+      gather_guide(guide_row, guidep + yy * guide_stride, guide_shift, -span, 8 + span * 2, diff_l, diff_r);
+    for (int xx = -span + nb.first(yy); xx <= span; xx += 1 + nb.sparse) {
+      __m128i neighbour_pixel = load_16<sl>(srcp + yy * stride + xx * offset);
 
       __m128i abs_diff = _mm_or_si128(_mm_subs_epu16(center_pixel, neighbour_pixel),
                       _mm_subs_epu16(neighbour_pixel, center_pixel));
 
       // Absolute difference less than or equal to th - 1 will be all zeroes.
-      abs_diff = _mm_subs_epu16(abs_diff, words_th);
-
       // 0 words become 65535, not 0 words become 0.
-      __m128i mask = _mm_cmpeq_epi16(abs_diff, zeroes);
+      __m128i mask = _mm_cmpeq_epi16(_mm_subs_epu16(abs_diff, words_th[0]), zeroes);
+      __m128i soft_mask = at == SoftMean ? _mm_cmpeq_epi16(_mm_subs_epu16(abs_diff, words_th[1]), zeroes) : zeroes;
+
+      if constexpr (gt != Unguided) {
+        // Chroma taps are only accepted where the co-sited luma is similar as well.
+        __m128i guide_pixel;
+        if constexpr (pt == Slow)
+          guide_pixel = _mm_loadu_si128((const __m128i *)(guide_row + span + xx));
+        else
+          guide_pixel = load_guide<gt>(guidep + yy * guide_stride + (xx << guide_shift));
+        __m128i guide_diff = _mm_or_si128(_mm_subs_epu16(guide_center, guide_pixel),
+                        _mm_subs_epu16(guide_pixel, guide_center));
+        __m128i guide_mask = _mm_cmpeq_epi16(_mm_subs_epu16(guide_diff, guide_th), zeroes);
+        mask = _mm_and_si128(mask, guide_mask);
+        soft_mask = _mm_and_si128(soft_mask, guide_mask);
+      }
 
       if constexpr (pt == Slow) {
-        __m128i m_border_check = _mm_loadu_si128((const __m128i *)(border_check+radius+xx));
+        __m128i m_border_check = load_16<sl>(border_check + reach + xx * step);
         mask = _mm_and_si128(mask, m_border_check);
+        soft_mask = _mm_and_si128(soft_mask, m_border_check);
+      }
+
+      if constexpr (at == Median) {
+        __m128i rejected = _mm_cmpeq_epi16(mask, zeroes);
+        taps[n++] = _mm_or_si128(_mm_and_si128(mask, neighbour_pixel), _mm_and_si128(rejected, fill));
+        fill = _mm_xor_si128(fill, rejected);
+        continue;
       }
 
       // Subtract 65535 aka -1
@@ -147,14 +390,37 @@ static void core_16(const uint16_t *srcp, uint16_t *dstp, int y, int height, int
                     _mm_unpacklo_epi16(pixels, zeroes));
       sum_hi = _mm_add_epi32(sum_hi,
                     _mm_unpackhi_epi16(pixels, zeroes));
+
+      if constexpr (at == SoftMean) {
+        soft_counter = _mm_sub_epi16(soft_counter, soft_mask);
+        __m128i soft_pixels = _mm_and_si128(soft_mask, neighbour_pixel);
+        soft_sum_lo = _mm_add_epi32(soft_sum_lo, _mm_unpacklo_epi16(soft_pixels, zeroes));
+        soft_sum_hi = _mm_add_epi32(soft_sum_hi, _mm_unpackhi_epi16(soft_pixels, zeroes));
+      }
     }
   }
 
+  auto rcp = [approximate](const __m128 &a) { return approximate ? _mm_rcp_ps(a) : _mm_rcpnr_ps(a); };
+
+  if constexpr (at == Median) {
+    // Rows outside the frame are left out, so even counts take one more
+    // rejected tap.
+    if (!(n & 1))
+      taps[n++] = fill;
+    return select_median<uint16_t>(taps, n, nb);
+  }
+
+  if constexpr (at == SoftMean) {
+    counter = _mm_add_epi16(counter, soft_counter);
+    sum_lo = _mm_add_epi32(sum_lo, soft_sum_lo);
+    sum_hi = _mm_add_epi32(sum_hi, soft_sum_hi);
+  }
+
   __m128 counter_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(counter, zeroes));
   __m128 counter_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(counter, zeroes));
 
-  __m128 resultf_lo = _mm_mul_ps(_mm_cvtepi32_ps(sum_lo), _mm_rcpnr_ps(counter_lo));
-  __m128 resultf_hi = _mm_mul_ps(_mm_cvtepi32_ps(sum_hi), _mm_rcpnr_ps(counter_hi));
+  __m128 resultf_lo = _mm_mul_ps(_mm_cvtepi32_ps(sum_lo), rcp(counter_lo));
+  __m128 resultf_hi = _mm_mul_ps(_mm_cvtepi32_ps(sum_hi), rcp(counter_hi));
 
   // Add 0.5f for rounding.
   resultf_lo = _mm_add_ps(resultf_lo, _mm_set1_ps(0.501f));
@@ -174,62 +440,220 @@ static void core_16(const uint16_t *srcp, uint16_t *dstp, int y, int height, int
 
   __m128i result = _mm_packs_epi32(result_lo, result_hi);
 
-  _mm_store_si128((__m128i *)dstp, _mm_add_epi16(result, _mm_set1_epi16(32768)));
+  return _mm_add_epi16(result, _mm_set1_epi16(32768));
+}
+
+// Pick the core of an average type.
+template <PathType pt, GuideType gt, SampleLayout sl, typename... Args>
+static inline __m128i average_8(AverageType at, const Args &... args) {
+  switch (at) {
+    case SoftMean: return core_8<pt, gt, sl, SoftMean>(args...);
+    case Median: return core_8<pt, gt, sl, Median>(args...);
+    default: return core_8<pt, gt, sl, Mean>(args...);
+  }
+}
+
+template <PathType pt, GuideType gt, SampleLayout sl, typename... Args>
+static inline __m128i average_16(AverageType at, const Args &... args) {
+  switch (at) {
+    case SoftMean: return core_16<pt, gt, sl, SoftMean>(args...);
+    case Median: return core_16<pt, gt, sl, Median>(args...);
+    default: return core_16<pt, gt, sl, Mean>(args...);
+  }
 }
 
-void minideen_SSE2_8(const uint8_t *srcp, uint8_t *dstp, int width, int height, int src_stride, int dst_stride, unsigned threshold, int radius)
+// Filter one block and store it, keeping the source in unfiltered U/V lanes.
+template <PathType pt, GuideType gt, SampleLayout sl>
+static inline void block_8(const uint8_t *srcp, uint8_t *dstp, int y, int height, int stride, const __m128i *bytes_th, int diff_l, int diff_r, const Neighbourhood &nb, const uint8_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate, AverageType at, const __m128i &keep)
 {
-  const uint8_t *srcp_orig = srcp;
-  uint8_t *dstp_orig = dstp;
+  __m128i result = average_8<pt, gt, sl>(at, srcp, y, height, stride, bytes_th, diff_l, diff_r, nb, guidep, guide_stride, guide_th, approximate);
+  if constexpr (sl == Interleaved)
+    result = blend(keep, _mm_loadu_si128((const __m128i *)srcp), result);
+  _mm_store_si128((__m128i *)dstp, result);
+}
 
-  // Subtract 1 so we can use a less than or equal comparison instead of less than.
-  __m128i bytes_th = _mm_set1_epi8(threshold - 1);
+template <PathType pt, GuideType gt, SampleLayout sl>
+static inline void block_16(const uint16_t *srcp, uint16_t *dstp, int y, int height, int stride, const __m128i *words_th, int diff_l, int diff_r, const Neighbourhood &nb, const uint16_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate, AverageType at, const __m128i &keep)
+{
+  __m128i result = average_16<pt, gt, sl>(at, srcp, y, height, stride, words_th, diff_l, diff_r, nb, guidep, guide_stride, guide_th, approximate);
+  if constexpr (sl == Interleaved)
+    result = blend(keep, _mm_loadu_si128((const __m128i *)srcp), result);
+  _mm_store_si128((__m128i *)dstp, result);
+}
+
+template <GuideType gt, SampleLayout sl = Planar>
+static void row_8(const uint8_t *srcp, uint8_t *dstp, int y, int width, int height, int stride, const __m128i *bytes_th, const Neighbourhood &nb, const uint8_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate, AverageType at, const __m128i &keep = zeroes)
+{
+  constexpr int guide_shift = gt == Unguided ? 0 : gt - GuideFull;
+  auto guide_at = [&](int x) { return gt == Unguided ? nullptr : guidep + (x << guide_shift); };
 
   const int step = 16;
+  constexpr int pitch = sample_pitch(sl);
+  // Decimated taps reach half as far in output elements.
+  const int reach = sl == Decimated ? (nb.radius_h + 1) / 2 : nb.radius_h * tap_step(sl);
 
   // Skip radius pixels on the left and at least radius pixels on the right.
-  int width_simd = width & -step;
+  int fast_path_l = (reach | (step - 1)) + 1;
+  int fast_path_r = std::max((width - reach) & -step, fast_path_l);
+
+  for (int x = 0; x < fast_path_l; x += step)
+    block_8<Slow, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, bytes_th, x, width - x, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+  for (int x = fast_path_l; x < fast_path_r; x += step)
+    block_8<Fast, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, bytes_th, 0, 0, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+  for (int x = fast_path_r; x < width; x += step)
+    block_8<Slow, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, bytes_th, x, width - x, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+}
 
-  int fast_path_l = (radius | (step - 1)) + 1;
-  int fast_path_r = (width - radius) & -step;
+template <GuideType gt, SampleLayout sl = Planar>
+static void row_16(const uint16_t *srcp, uint16_t *dstp, int y, int width, int height, int stride, const __m128i *words_th, const Neighbourhood &nb, const uint16_t *guidep, int guide_stride, const __m128i &guide_th, bool approximate, AverageType at, const __m128i &keep = zeroes)
+{
+  constexpr int guide_shift = gt == Unguided ? 0 : gt - GuideFull;
+  auto guide_at = [&](int x) { return gt == Unguided ? nullptr : guidep + (x << guide_shift); };
 
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < fast_path_l; x += step)
-      core_8<Slow>(srcp+x, dstp+x, y, height, src_stride, bytes_th, x, width - x, radius);
-    for (int x = fast_path_l; x < fast_path_r; x += step)
-      core_8<Fast>(srcp+x, dstp+x, y, height, src_stride, bytes_th, 0, 0, radius);
-    for (int x = fast_path_r; x < width; x += step)
-      core_8<Slow>(srcp+x, dstp+x, y, height, src_stride, bytes_th, x, width - x, radius);
+  const int step = 8;
+  constexpr int pitch = sample_pitch(sl);
+  // Decimated taps reach half as far in output elements.
+  const int reach = sl == Decimated ? (nb.radius_h + 1) / 2 : nb.radius_h * tap_step(sl);
+
+  int fast_path_l = (reach | (step - 1)) + 1;
+  int fast_path_r = std::max((width - reach) & -step, fast_path_l);
+
+  for (int x = 0; x < fast_path_l; x += step)
+    block_16<Slow, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, words_th, x, width - x, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+  for (int x = fast_path_l; x < fast_path_r; x += step)
+    block_16<Fast, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, words_th, 0, 0, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+  for (int x = fast_path_r; x < width; x += step)
+    block_16<Slow, gt, sl>(srcp+x*pitch, dstp+x, y, height, stride, words_th, x, width - x, nb, guide_at(x), guide_stride, guide_th, approximate, at, keep);
+}
 
-    srcp += src_stride;
-    dstp += dst_stride;
+// YUY2 is split into 16 luma and 16 chroma lanes straight from the packed
+// bytes, each filtered with its own threshold and neighbourhood, and
+// interleaved back on store.
+template <PathType pt>
+static inline void block_yuy2(const uint8_t *srcp, uint8_t *dstp, int y, int height, int stride, const PlaneJob &job, const __m128i *luma_th, const __m128i *chroma_th, const __m128i &chroma_keep, int diff_l, int diff_r)
+{
+  __m128i luma = load_8<PackedLuma>(srcp);
+  __m128i chroma = load_8<PackedChroma>(srcp);
+  if (job.filter_luma)
+    luma = average_8<pt, Unguided, PackedLuma>(job.average(), srcp, y, height, stride, luma_th, diff_l, diff_r, *job.nb, nullptr, 0, zeroes, job.approximate);
+  if (job.filter_chroma[0] || job.filter_chroma[1]) {
+    __m128i result = average_8<pt, Unguided, PackedChroma>(job.chroma_average(), srcp, y, height, stride, chroma_th, diff_l, diff_r, *job.chroma_nb, nullptr, 0, zeroes, job.approximate);
+    chroma = blend(chroma_keep, chroma, result);
   }
+  _mm_store_si128((__m128i *)dstp, _mm_unpacklo_epi8(luma, chroma));
+  _mm_store_si128((__m128i *)(dstp + 16), _mm_unpackhi_epi8(luma, chroma));
 }
 
-void minideen_SSE2_16(const uint8_t *srcp8, uint8_t *dstp8, int width, int height, int src_stride, int dst_stride, unsigned threshold, int radius)
+static void row_yuy2(const uint8_t *srcp, uint8_t *dstp, int y, int width, int height, int stride, const PlaneJob &job, const __m128i *luma_th, const __m128i *chroma_th, const __m128i &chroma_keep)
 {
-  const uint16_t *srcp = reinterpret_cast<const uint16_t *>(srcp8);
-  uint16_t *dstp = reinterpret_cast<uint16_t *>(dstp8);
-  src_stride /= 2;
-  dst_stride /= 2;
+  const int step = 16;
+  int reach = job.filter_luma ? job.nb->radius_h : 0;
+  if (job.filter_chroma[0] || job.filter_chroma[1])
+    reach = std::max(reach, job.chroma_nb->radius_h * tap_step(PackedChroma));
+
+  int fast_path_l = (reach | (step - 1)) + 1;
+  int fast_path_r = std::max((width - reach) & -step, fast_path_l);
+
+  for (int x = 0; x < fast_path_l; x += step)
+    block_yuy2<Slow>(srcp+x*2, dstp+x*2, y, height, stride, job, luma_th, chroma_th, chroma_keep, x, width - x);
+  for (int x = fast_path_l; x < fast_path_r; x += step)
+    block_yuy2<Fast>(srcp+x*2, dstp+x*2, y, height, stride, job, luma_th, chroma_th, chroma_keep, 0, 0);
+  for (int x = fast_path_r; x < width; x += step)
+    block_yuy2<Slow>(srcp+x*2, dstp+x*2, y, height, stride, job, luma_th, chroma_th, chroma_keep, x, width - x);
+}
 
+void minideen_SSE2_8(const PlaneJob *jobs, int count, int width, int height, int y0, int y1)
+{
   // Subtract 1 so we can use a less than or equal comparison instead of less than.
-  __m128i words_th = _mm_set1_epi16(threshold - 1);
-
-  const int step = 8;
+  // Interleaved chroma alternates U and V lanes, each with its own threshold.
+  // Each threshold is a pair of the full weight and the half weight one.
+  __m128i bytes_th[max_planes][2], guide_th[max_planes], chroma_th[max_planes][2], chroma_keep[max_planes];
+  for (int i = 0; i < count; i++) {
+    const PlaneJob &job = jobs[i];
+    bytes_th[i][0] = _mm_set1_epi8(job.threshold - 1);
+    bytes_th[i][1] = _mm_set1_epi8(std::max(job.threshold_hi, job.threshold) - 1);
+    guide_th[i] = _mm_set1_epi8(job.guide_threshold - 1);
+    chroma_th[i][0] = _mm_set1_epi16((((job.chroma_threshold[1] - 1) & 0xFF) << 8) | ((job.chroma_threshold[0] - 1) & 0xFF));
+    chroma_th[i][1] = _mm_set1_epi16((((std::max(job.chroma_threshold_hi[1], job.chroma_threshold[1]) - 1) & 0xFF) << 8) | ((std::max(job.chroma_threshold_hi[0], job.chroma_threshold[0]) - 1) & 0xFF));
+    chroma_keep[i] = _mm_set1_epi16((job.filter_chroma[1] ? 0 : 0xFF00) | (job.filter_chroma[0] ? 0 : 0x00FF));
+  }
 
-  int fast_path_l = (radius | (step - 1)) + 1;
-  int fast_path_r = (width - radius) & -step;
+  // All planes are swept together row by row.
+  for (int y = y0; y < y1; y++)
+    for (int i = 0; i < count; i++) {
+      const PlaneJob &job = jobs[i];
+      int sy = y * job.scale;
+      const uint8_t *srcp = job.srcp + sy * job.src_stride;
+      uint8_t *dstp = job.dstp + y * job.dst_stride;
+      int stride = job.src_stride;
+      if (job.scale == 2) {
+        row_8<Unguided, Decimated>(srcp, dstp, sy, width / 2, height, stride, bytes_th[i], *job.nb, nullptr, 0, guide_th[i], job.approximate, job.average());
+        continue;
+      }
+      if (job.layout == LayoutSemiPlanar) {
+        row_8<Unguided, Interleaved>(srcp, dstp, y, width * 2, height, stride, chroma_th[i], *job.chroma_nb, nullptr, 0, guide_th[i], job.approximate, job.chroma_average(), chroma_keep[i]);
+        continue;
+      }
+      if (job.layout == LayoutYUY2) {
+        row_yuy2(srcp, dstp, y, width, height, stride, job, bytes_th[i], chroma_th[i], chroma_keep[i]);
+        continue;
+      }
+      if (!job.guidep) {
+        row_8<Unguided>(srcp, dstp, y, width, height, stride, bytes_th[i], *job.nb, nullptr, 0, guide_th[i], job.approximate, job.average());
+        continue;
+      }
 
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < fast_path_l; x += step)
-      core_16<Slow>(srcp+x, dstp+x, y, height, src_stride, words_th, x, width - x, radius);
-    for (int x = fast_path_l; x < fast_path_r; x += step)
-      core_16<Fast>(srcp+x, dstp+x, y, height, src_stride, words_th, 0, 0, radius);
-    for (int x = fast_path_r; x < width; x += step)
-      core_16<Slow>(srcp+x, dstp+x, y, height, src_stride, words_th, x, width - x, radius);
+      const uint8_t *guidep = job.guidep + (y << job.guide_ssh) * job.guide_stride;
+      int guide_stride = job.guide_stride << job.guide_ssh;
+      switch (job.guide_ssw) {
+        case 0: row_8<GuideFull>(srcp, dstp, y, width, height, stride, bytes_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+        case 1: row_8<GuideHalf>(srcp, dstp, y, width, height, stride, bytes_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+        case 2: row_8<GuideQuarter>(srcp, dstp, y, width, height, stride, bytes_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+      }
+    }
+}
 
-    srcp += src_stride;
-    dstp += dst_stride;
+void minideen_SSE2_16(const PlaneJob *jobs, int count, int width, int height, int y0, int y1)
+{
+  // Subtract 1 so we can use a less than or equal comparison instead of less than.
+  // Each threshold is a pair of the full weight and the half weight one.
+  __m128i words_th[max_planes][2], guide_th[max_planes], chroma_th[max_planes][2], chroma_keep[max_planes];
+  for (int i = 0; i < count; i++) {
+    const PlaneJob &job = jobs[i];
+    words_th[i][0] = _mm_set1_epi16(job.threshold - 1);
+    words_th[i][1] = _mm_set1_epi16(std::max(job.threshold_hi, job.threshold) - 1);
+    guide_th[i] = _mm_set1_epi16(job.guide_threshold - 1);
+    chroma_th[i][0] = _mm_set1_epi32((((job.chroma_threshold[1] - 1) & 0xFFFF) << 16) | ((job.chroma_threshold[0] - 1) & 0xFFFF));
+    chroma_th[i][1] = _mm_set1_epi32((((std::max(job.chroma_threshold_hi[1], job.chroma_threshold[1]) - 1) & 0xFFFF) << 16) | ((std::max(job.chroma_threshold_hi[0], job.chroma_threshold[0]) - 1) & 0xFFFF));
+    chroma_keep[i] = _mm_set1_epi32((job.filter_chroma[1] ? 0 : 0xFFFF0000) | (job.filter_chroma[0] ? 0 : 0x0000FFFF));
   }
+
+  for (int y = y0; y < y1; y++)
+    for (int i = 0; i < count; i++) {
+      const PlaneJob &job = jobs[i];
+      int sy = y * job.scale;
+      auto srcp = reinterpret_cast<const uint16_t *>(job.srcp + sy * job.src_stride);
+      auto dstp = reinterpret_cast<uint16_t *>(job.dstp + y * job.dst_stride);
+      int stride = job.src_stride / sizeof(uint16_t);
+      if (job.scale == 2) {
+        row_16<Unguided, Decimated>(srcp, dstp, sy, width / 2, height, stride, words_th[i], *job.nb, nullptr, 0, guide_th[i], job.approximate, job.average());
+        continue;
+      }
+      if (job.layout == LayoutSemiPlanar) {
+        row_16<Unguided, Interleaved>(srcp, dstp, y, width * 2, height, stride, chroma_th[i], *job.chroma_nb, nullptr, 0, guide_th[i], job.approximate, job.chroma_average(), chroma_keep[i]);
+        continue;
+      }
+      if (!job.guidep) {
+        row_16<Unguided>(srcp, dstp, y, width, height, stride, words_th[i], *job.nb, nullptr, 0, guide_th[i], job.approximate, job.average());
+        continue;
+      }
+
+      auto guidep = reinterpret_cast<const uint16_t *>(job.guidep + (y << job.guide_ssh) * job.guide_stride);
+      int guide_stride = (job.guide_stride << job.guide_ssh) / sizeof(uint16_t);
+      switch (job.guide_ssw) {
+        case 0: row_16<GuideFull>(srcp, dstp, y, width, height, stride, words_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+        case 1: row_16<GuideHalf>(srcp, dstp, y, width, height, stride, words_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+        case 2: row_16<GuideQuarter>(srcp, dstp, y, width, height, stride, words_th[i], *job.nb, guidep, guide_stride, guide_th[i], job.approximate, job.average()); break;
+      }
+    }
 }
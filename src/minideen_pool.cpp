@@ -0,0 +1,196 @@
+#include "minideen_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Tasks of one pool_run call.
+struct Batch {
+  const std::function<void(int)> *task;
+  std::atomic<int> remaining;
+};
+
+struct Task {
+  Batch *batch;
+  int index;
+};
+
+// Every worker pops from the back of its own queue and steals from the
+// front of the others, so a batch spread over the queues drains evenly.
+struct Queue {
+  std::mutex mutex;
+  std::deque<Task> tasks;
+};
+
+class Pool {
+public:
+  Pool() {
+    int workers = pool_threads() - 1;
+    for (int i = 0; i < workers; i++)
+      queues.emplace_back(new Queue);
+    for (int i = 0; i < workers; i++)
+      threads.emplace_back([this, i] { work(i); });
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> guard(wake_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &&thread : threads)
+      thread.join();
+  }
+
+  void run(int count, const std::function<void(int)> &task) {
+    if (threads.empty()) {
+      for (int i = 0; i < count; i++)
+        task(i);
+      return;
+    }
+
+    Batch batch {&task, {count}};
+    int next = submit_from.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+      auto &queue = *queues[(next + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(queue.mutex);
+      queue.tasks.push_back(Task {&batch, i});
+    }
+    {
+      std::lock_guard<std::mutex> guard(wake_mutex);
+      pending += count;
+    }
+    wake.notify_all();
+
+    // Help with whatever is queued until this batch is done.
+    while (batch.remaining.load(std::memory_order_acquire) > 0) {
+      Task t;
+      if (steal(-1, t)) {
+        execute(t);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(done_mutex);
+      done.wait(lock, [&] { return batch.remaining.load(std::memory_order_acquire) == 0; });
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<int> submit_from {0};
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  int pending {0};
+  bool stopping {false};
+  std::mutex done_mutex;
+  std::condition_variable done;
+
+  bool pop(Queue &queue, Task &t, bool back) {
+    std::lock_guard<std::mutex> guard(queue.mutex);
+    if (queue.tasks.empty())
+      return false;
+    if (back) {
+      t = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    else {
+      t = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+
+  // Own queue first when self is a worker, then the others in turn.
+  bool steal(int self, Task &t) {
+    int n = static_cast<int>(queues.size());
+    if (self >= 0 && pop(*queues[self], t, true))
+      return true;
+    for (int i = 1; i <= n; i++) {
+      int victim = (std::max(self, 0) + i) % n;
+      if (victim != self && pop(*queues[victim], t, false))
+        return true;
+    }
+    return false;
+  }
+
+  void execute(const Task &t) {
+    {
+      std::lock_guard<std::mutex> guard(wake_mutex);
+      pending--;
+    }
+    (*t.batch->task)(t.index);
+    if (t.batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> guard(done_mutex);
+      done.notify_all();
+    }
+  }
+
+  void work(int self) {
+    for (;;) {
+      Task t;
+      if (steal(self, t)) {
+        execute(t);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      wake.wait(lock, [&] { return stopping || pending > 0; });
+      if (stopping)
+        return;
+    }
+  }
+};
+
+// Never destroyed by a static destructor: that runs at unload, under the
+// Windows loader lock, which exiting threads need too.
+std::mutex users_mutex;
+int users {0};
+std::atomic<Pool *> instance {nullptr};
+
+}
+
+int pool_threads() {
+  static const int threads = [] {
+    const char *setting = std::getenv("MINIDEEN_POOL_THREADS");
+    if (setting) {
+      char *end = nullptr;
+      long count = std::strtol(setting, &end, 10);
+      if (end != setting && *end == '\0' && count > 0)
+        return static_cast<int>(std::min(count, 1024L));
+    }
+    return std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }();
+  return threads;
+}
+
+void pool_acquire() {
+  std::lock_guard<std::mutex> guard(users_mutex);
+  if (users++ == 0)
+    instance.store(new Pool, std::memory_order_release);
+}
+
+void pool_release() {
+  Pool *stopped = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(users_mutex);
+    if (--users == 0)
+      stopped = instance.exchange(nullptr, std::memory_order_acq_rel);
+  }
+  delete stopped;
+}
+
+void pool_run(int count, const std::function<void(int)> &task) {
+  Pool *pool = instance.load(std::memory_order_acquire);
+  if (count == 1 || !pool) {
+    for (int i = 0; i < count; i++)
+      task(i);
+  }
+  else
+    pool->run(count, task);
+}
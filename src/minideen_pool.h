@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+
+// Worker threads shared by every MiniDeen instance in the process, so
+// several instances in a script do not oversubscribe the cores. Sized from
+// the hardware concurrency, counting the calling thread, unless the
+// MINIDEEN_POOL_THREADS environment variable holds a positive count. Read
+// once per process.
+int pool_threads();
+
+// Instances that submit tasks hold the pool from initialization until the
+// host frees them. The workers start with the first holder and are joined
+// when the last one releases, never at plugin unload.
+void pool_acquire();
+void pool_release();
+
+// Run task(0) .. task(count - 1) on the pool and return once all of them
+// are done. The calling thread runs tasks too while it waits, and runs
+// them all when the pool is not held.
+void pool_run(int count, const std::function<void(int)> &task);
@@ -0,0 +1,56 @@
+#include "minideen_common.h"
+#include <algorithm>
+#include <vector>
+
+template <typename PixelType>
+void pyramid_reduce(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height) {
+  int low_width = (width + 1) / 2;
+  int low_height = (height + 1) / 2;
+
+  // 2x2 box average, repeating the last row and column of odd sized planes.
+  for (int y = 0; y < low_height; y++) {
+    auto src0 = reinterpret_cast<const PixelType *>(srcp + y * 2 * src_stride);
+    auto src1 = reinterpret_cast<const PixelType *>(srcp + std::min(y * 2 + 1, height - 1) * src_stride);
+    auto dst = reinterpret_cast<PixelType *>(dstp + y * dst_stride);
+    for (int x = 0; x < low_width; x++) {
+      int x0 = x * 2, x1 = std::min(x * 2 + 1, width - 1);
+      dst[x] = (src0[x0] + src0[x1] + src1[x0] + src1[x1] + 2) >> 2;
+    }
+  }
+}
+
+template <typename PixelType>
+void pyramid_expand(uint8_t *dstp, int dst_stride, const uint8_t *lowp, const uint8_t *filteredp, int low_stride, int width, int height, int pixel_max) {
+  int low_width = (width + 1) / 2;
+  int low_height = (height + 1) / 2;
+  std::vector<int> row(low_width);
+
+  auto correction = [&](int y, int x) {
+    auto low = reinterpret_cast<const PixelType *>(lowp + y * low_stride);
+    auto filtered = reinterpret_cast<const PixelType *>(filteredp + y * low_stride);
+    return (int)filtered[x] - (int)low[x];
+  };
+
+  // Bilinear upsampling of the half resolution correction: every output
+  // sample weighs the nearest low sample by 3/4 and the next one by 1/4 in
+  // each direction.
+  for (int y = 0; y < height; y++) {
+    int ya = y / 2;
+    int yb = std::clamp(y & 1 ? ya + 1 : ya - 1, 0, low_height - 1);
+    for (int x = 0; x < low_width; x++)
+      row[x] = correction(ya, x) * 3 + correction(yb, x);
+
+    auto dst = reinterpret_cast<PixelType *>(dstp + y * dst_stride);
+    for (int x = 0; x < width; x++) {
+      int xa = x / 2;
+      int xb = std::clamp(x & 1 ? xa + 1 : xa - 1, 0, low_width - 1);
+      int value = dst[x] + ((row[xa] * 3 + row[xb] + 8) >> 4);
+      dst[x] = std::clamp(value, 0, pixel_max);
+    }
+  }
+}
+
+template void pyramid_reduce<uint8_t>(const uint8_t *, int, uint8_t *, int, int, int);
+template void pyramid_reduce<uint16_t>(const uint8_t *, int, uint8_t *, int, int, int);
+template void pyramid_expand<uint8_t>(uint8_t *, int, const uint8_t *, const uint8_t *, int, int, int, int);
+template void pyramid_expand<uint16_t>(uint8_t *, int, const uint8_t *, const uint8_t *, int, int, int, int);
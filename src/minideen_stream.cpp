@@ -0,0 +1,45 @@
+#include "minideen_stream.h"
+#include <algorithm>
+#include <array>
+
+RowStream::RowStream(int height, int reach, int scale, int band, Callback run, Callback done, int y_begin, int y_end)
+  : height(height), reach(reach), scale(std::max(scale, 1)), band(std::max(band, 1)), run(std::move(run)), done(std::move(done)) {
+  int out_height = height / this->scale;
+  next = std::clamp(y_begin, 0, out_height);
+  end = y_end < 0 ? out_height : std::clamp(y_end, next, out_height);
+}
+
+static int job_reach(const PlaneJob *jobs, int count) {
+  int reach = 0;
+  for (int i = 0; i < count; i++) {
+    reach = std::max(reach, jobs[i].nb->radius_v);
+    if (jobs[i].chroma_nb)
+      reach = std::max(reach, jobs[i].chroma_nb->radius_v);
+  }
+  return reach;
+}
+
+RowStream::RowStream(MiniDeenKernel kernel, const PlaneJob *jobs, int count, int width, int height, int band, Callback done, int y_begin, int y_end)
+  : RowStream(height, job_reach(jobs, std::min(count, max_planes)), count > 0 ? jobs[0].scale : 1, band, nullptr, std::move(done), y_begin, y_end) {
+  std::array<PlaneJob, max_planes> copy;
+  count = std::min(count, max_planes);
+  std::copy(jobs, jobs + count, copy.begin());
+  run = [kernel, copy, count, width, height](int y0, int y1) {
+    kernel(copy.data(), count, width, height, y0, y1);
+  };
+}
+
+void RowStream::push(int rows) {
+  // Output row y reads source rows up to y * scale + reach.
+  int ready = end;
+  if (rows < height)
+    ready = std::min(rows - 1 - reach < 0 ? 0 : (rows - 1 - reach) / scale + 1, end);
+
+  while (next < ready) {
+    int y1 = std::min(next + band, ready);
+    run(next, y1);
+    if (done)
+      done(next, y1);
+    next = y1;
+  }
+}
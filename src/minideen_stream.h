@@ -0,0 +1,35 @@
+#pragma once
+
+#include "minideen_common.h"
+#include <functional>
+
+// Runs output rows as the source rows they read arrive, so the top of the
+// output can be handed on before the bottom of the source exists. Output
+// rows y_begin .. y_end - 1 are run in top to bottom order, in chunks of at
+// most band rows, as soon as the source rows they reach are in place.
+class RowStream {
+public:
+  // Output rows y0 .. y1 - 1.
+  typedef std::function<void(int y0, int y1)> Callback;
+
+  // Output row y reads source rows up to y * scale + reach of height. run
+  // writes the rows and done, when set, is told they are written.
+  RowStream(int height, int reach, int scale, int band, Callback run, Callback done = nullptr, int y_begin = 0, int y_end = -1);
+
+  // Runs a kernel over planes of the same geometry, like those of one
+  // kernel sweep. A guide plane must be complete before the first push.
+  RowStream(MiniDeenKernel kernel, const PlaneJob *jobs, int count, int width, int height, int band, Callback done = nullptr, int y_begin = 0, int y_end = -1);
+
+  // Source rows 0 .. rows - 1 are in place. Runs every output row whose
+  // taps are all available; the last rows go once rows reaches the height.
+  void push(int rows);
+
+  // Output rows written so far, counted from 0.
+  int rows_done() const { return next; }
+  bool finished() const { return next >= end; }
+
+private:
+  int height, reach, scale, band;
+  Callback run, done;
+  int next, end;
+};
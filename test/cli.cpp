@@ -0,0 +1,202 @@
+// Pipes generated Y4M through minideen-cli with one and with several
+// threads. Every frame must match minideen_process_plane on its planes, in
+// order. The same frames as a headerless file through --raw must come out
+// as in Y4M mode, and an output path naming the input must be refused
+// without touching it. Colorspaces the CLI cannot filter, such as 444alpha,
+// must be refused rather than misread.
+
+#include "libminideen.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr int width {96}, height {54}, frames {7};
+static constexpr int radius {2}, threshold {10}, threshold_uv {12};
+
+struct Clip {
+  std::string colorspace;
+  int bits, ssw, ssh;
+  int plane_width(int p) const { return p ? width >> ssw : width; }
+  int plane_height(int p) const { return p ? height >> ssh : height; }
+  size_t frame_bytes() const {
+    size_t samples = 0;
+    for (int p = 0; p < 3; p++)
+      samples += static_cast<size_t>(plane_width(p)) * plane_height(p);
+    return samples * (bits > 8 ? 2 : 1);
+  }
+  std::string header() const {
+    return "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F25:1 Ip A1:1 C" + colorspace + "\n";
+  }
+};
+
+static bool write_file(const std::string &path, const std::string &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  return fclose(f) == 0 && ok;
+}
+
+static bool read_file(const std::string &path, std::string &data) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  data.clear();
+  char buffer[65536];
+  for (size_t got; (got = fread(buffer, 1, sizeof(buffer), f)) > 0;)
+    data.append(buffer, got);
+  fclose(f);
+  return true;
+}
+
+// Tightly packed frames of noisy gradients, samples little-endian.
+static std::vector<std::string> make_frames(const Clip &clip) {
+  std::mt19937 rng(clip.bits * 31 + clip.ssw * 7 + clip.ssh);
+  int max = (1 << clip.bits) - 1;
+  std::vector<std::string> result;
+  for (int n = 0; n < frames; n++) {
+    std::string frame;
+    for (int p = 0; p < 3; p++)
+      for (int y = 0; y < clip.plane_height(p); y++)
+        for (int x = 0; x < clip.plane_width(p); x++) {
+          int value = (((x / 8 + y / 4 + n + p) * 23) % 200 + static_cast<int>(rng() % 24)) * max / 255;
+          frame += static_cast<char>(value & 0xff);
+          if (clip.bits > 8)
+            frame += static_cast<char>(value >> 8);
+        }
+    result.push_back(frame);
+  }
+  return result;
+}
+
+static std::string filter(const Clip &clip, const std::string &frame) {
+  minideen_params luma {clip.bits, radius, threshold, 0}, chroma {clip.bits, radius, threshold_uv, 0};
+  minideen_context *contexts[2] {minideen_create(&luma, nullptr), minideen_create(&chroma, nullptr)};
+  std::string out(frame.size(), '\0');
+  int bytes = clip.bits > 8 ? 2 : 1;
+  size_t offset = 0;
+  for (int p = 0; p < 3; p++) {
+    int row = clip.plane_width(p) * bytes;
+    minideen_process_plane(contexts[p ? 1 : 0], frame.data() + offset, row, &out[offset], row, clip.plane_width(p), clip.plane_height(p));
+    offset += static_cast<size_t>(row) * clip.plane_height(p);
+  }
+  minideen_free(contexts[0]);
+  minideen_free(contexts[1]);
+  return out;
+}
+
+static std::string options(int threads) {
+  return " -r " + std::to_string(radius) + " -t " + std::to_string(threshold) + " -u " + std::to_string(threshold_uv) + " -j " + std::to_string(threads);
+}
+
+static int run(const std::string &cli, const std::string &args) {
+  std::string command = "\"" + cli + "\"" + args;
+  return system(command.c_str());
+}
+
+// The filtered frames, without headers, are appended to filtered.
+static int check_y4m(const std::string &cli, const Clip &clip, const std::vector<std::string> &source, int threads, std::string &filtered) {
+  std::string input = "cli-" + clip.colorspace + ".y4m", output = "cli-" + clip.colorspace + "-out.y4m";
+  std::string data = clip.header();
+  for (auto &&frame : source)
+    data += "FRAME\n" + frame;
+  if (!write_file(input, data))
+    return 1;
+  if (run(cli, options(threads) + " " + input + " > " + output) != 0 || !read_file(output, data)) {
+    fprintf(stderr, "C%s, -j %d: minideen-cli failed\n", clip.colorspace.c_str(), threads);
+    return 1;
+  }
+
+  size_t at = clip.header().size();
+  if (data.compare(0, at, clip.header()) != 0) {
+    fprintf(stderr, "C%s, -j %d: stream header changed\n", clip.colorspace.c_str(), threads);
+    return 1;
+  }
+  for (int n = 0; n < frames; n++, at += 6 + clip.frame_bytes()) {
+    if (data.compare(at, 6, "FRAME\n") != 0 || data.compare(at + 6, clip.frame_bytes(), filter(clip, source[n])) != 0) {
+      fprintf(stderr, "C%s, -j %d: frame %d differs from minideen_process_plane\n", clip.colorspace.c_str(), threads, n);
+      return 1;
+    }
+    filtered += data.substr(at + 6, clip.frame_bytes());
+  }
+  if (at != data.size()) {
+    fprintf(stderr, "C%s, -j %d: %zu bytes after the last frame\n", clip.colorspace.c_str(), threads, data.size() - at);
+    return 1;
+  }
+  remove(input.c_str());
+  remove(output.c_str());
+  return 0;
+}
+
+static int check_raw(const std::string &cli, const Clip &clip, const std::vector<std::string> &source, int threads, const std::string &filtered) {
+  std::string input = "cli-" + clip.colorspace + ".yuv", output = "cli-" + clip.colorspace + "-out.yuv";
+  std::string frames_in, data;
+  for (auto &&frame : source)
+    frames_in += frame;
+  if (!write_file(input, frames_in))
+    return 1;
+  std::string raw = options(threads) + " --raw " + std::to_string(width) + "x" + std::to_string(height) + " --format " + clip.colorspace + " " + input;
+  if (run(cli, raw + " -o " + output) != 0 || !read_file(output, data)) {
+    fprintf(stderr, "C%s, -j %d: minideen-cli --raw failed\n", clip.colorspace.c_str(), threads);
+    return 1;
+  }
+  if (data != filtered) {
+    fprintf(stderr, "C%s, -j %d: --raw output differs from Y4M mode\n", clip.colorspace.c_str(), threads);
+    return 1;
+  }
+
+  // Writing over the input, under its own name or another one, must fail
+  // and leave it whole.
+  int failed = 0;
+  for (auto &&same : {input, "./" + input}) {
+    if (run(cli, raw + " -o " + same) == 0) {
+      fprintf(stderr, "C%s: -o %s was accepted for input %s\n", clip.colorspace.c_str(), same.c_str(), input.c_str());
+      failed = 1;
+    }
+    if (!read_file(input, data) || data != frames_in) {
+      fprintf(stderr, "C%s: -o %s changed the input\n", clip.colorspace.c_str(), same.c_str());
+      failed = 1;
+    }
+  }
+  remove(input.c_str());
+  remove(output.c_str());
+  return failed;
+}
+
+static int check_refused(const std::string &cli, const std::string &colorspace) {
+  std::string input = "cli-refused.y4m";
+  if (!write_file(input, "YUV4MPEG2 W16 H16 F25:1 C" + colorspace + "\n"))
+    return 1;
+  if (run(cli, options(1) + " " + input + " > cli-refused-out.y4m") == 0) {
+    fprintf(stderr, "C%s was accepted\n", colorspace.c_str());
+    return 1;
+  }
+  remove(input.c_str());
+  remove("cli-refused-out.y4m");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: test-cli path/to/minideen-cli\n");
+    return 2;
+  }
+  std::string cli = argv[1];
+  const Clip clips[] {{"420", 8, 1, 1}, {"420jpeg", 8, 1, 1}, {"422p10", 10, 1, 0}, {"444p16", 16, 0, 0}};
+
+  int failed = 0;
+  for (auto &&clip : clips) {
+    auto source = make_frames(clip);
+    for (int threads : {1, 4}) {
+      std::string filtered;
+      failed |= check_y4m(cli, clip, source, threads, filtered);
+      failed |= check_raw(cli, clip, source, threads, filtered);
+    }
+  }
+  for (auto &&colorspace : {"444alpha", "420foo", "422jpeg", "420p", "mono16x", "411"})
+    failed |= check_refused(cli, colorspace);
+  return failed;
+}
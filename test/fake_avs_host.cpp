@@ -0,0 +1,85 @@
+// Just enough of the AviSynth+ core for the wrapper to run without a host:
+// the smart pointers and empty values behind AVS_Linkage. Frames are opaque
+// tokens that are not reference counted.
+
+#define BUILDING_AVSCORE 1
+#include <avisynth.h>
+#include <atomic>
+
+void IClip::AddRef() { reinterpret_cast<std::atomic<long> *>(const_cast<long *>(&refcnt))->fetch_add(1); }
+void IClip::Release() {
+  if (reinterpret_cast<std::atomic<long> *>(const_cast<long *>(&refcnt))->fetch_sub(1) == 1)
+    delete this;
+}
+
+void PClip::Init(IClip *x) {
+  if (x)
+    x->AddRef();
+  p = x;
+}
+void PClip::Set(IClip *x) {
+  if (x)
+    x->AddRef();
+  if (p)
+    p->Release();
+  p = x;
+}
+void PClip::CONSTRUCTOR0() { p = nullptr; }
+void PClip::CONSTRUCTOR1(const PClip &x) { Init(x.p); }
+void PClip::CONSTRUCTOR2(IClip *x) { Init(x); }
+void PClip::OPERATOR_ASSIGN0(IClip *x) { Set(x); }
+void PClip::OPERATOR_ASSIGN1(const PClip &x) { Set(x.p); }
+void PClip::DESTRUCTOR() {
+  if (p)
+    p->Release();
+}
+
+void PVideoFrame::CONSTRUCTOR0() { p = nullptr; }
+void PVideoFrame::CONSTRUCTOR1(const PVideoFrame &x) { p = x.p; }
+void PVideoFrame::CONSTRUCTOR2(VideoFrame *x) { p = x; }
+void PVideoFrame::OPERATOR_ASSIGN0(VideoFrame *x) { p = x; }
+void PVideoFrame::OPERATOR_ASSIGN1(const PVideoFrame &x) { p = x.p; }
+void PVideoFrame::DESTRUCTOR() {}
+
+const BYTE *VideoFrame::GetReadPtr(int) const { return reinterpret_cast<const BYTE *>(this); }
+BYTE *VideoFrame::GetWritePtr(int) const { return reinterpret_cast<BYTE *>(const_cast<VideoFrame *>(this)); }
+int VideoFrame::GetPitch(int) const { return 0; }
+
+void AVSValue::CONSTRUCTOR0() {
+  type = 'v';
+  array_size = 0;
+  clip = nullptr;
+}
+void AVSValue::CONSTRUCTOR9(const AVSValue &v) {
+  type = v.type;
+  array_size = v.array_size;
+  clip = v.clip;
+}
+void AVSValue::DESTRUCTOR() {}
+
+const AVS_Linkage *fake_avs_linkage() {
+  static AVS_Linkage linkage = [] {
+    AVS_Linkage l {};
+    l.Size = sizeof(AVS_Linkage);
+    l.PClip_CONSTRUCTOR0 = &PClip::CONSTRUCTOR0;
+    l.PClip_CONSTRUCTOR1 = &PClip::CONSTRUCTOR1;
+    l.PClip_CONSTRUCTOR2 = &PClip::CONSTRUCTOR2;
+    l.PClip_OPERATOR_ASSIGN0 = &PClip::OPERATOR_ASSIGN0;
+    l.PClip_OPERATOR_ASSIGN1 = &PClip::OPERATOR_ASSIGN1;
+    l.PClip_DESTRUCTOR = &PClip::DESTRUCTOR;
+    l.PVideoFrame_CONSTRUCTOR0 = &PVideoFrame::CONSTRUCTOR0;
+    l.PVideoFrame_CONSTRUCTOR1 = &PVideoFrame::CONSTRUCTOR1;
+    l.PVideoFrame_CONSTRUCTOR2 = &PVideoFrame::CONSTRUCTOR2;
+    l.PVideoFrame_OPERATOR_ASSIGN0 = &PVideoFrame::OPERATOR_ASSIGN0;
+    l.PVideoFrame_OPERATOR_ASSIGN1 = &PVideoFrame::OPERATOR_ASSIGN1;
+    l.PVideoFrame_DESTRUCTOR = &PVideoFrame::DESTRUCTOR;
+    l.VFGetReadPtr = &VideoFrame::GetReadPtr;
+    l.VFGetWritePtr = &VideoFrame::GetWritePtr;
+    l.GetPitch = &VideoFrame::GetPitch;
+    l.AVSValue_CONSTRUCTOR0 = &AVSValue::CONSTRUCTOR0;
+    l.AVSValue_CONSTRUCTOR9 = &AVSValue::CONSTRUCTOR9;
+    l.AVSValue_DESTRUCTOR = &AVSValue::DESTRUCTOR;
+    return l;
+  }();
+  return &linkage;
+}
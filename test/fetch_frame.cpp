@@ -0,0 +1,86 @@
+// Fetches input frames through AVSFetchFrameFunctor from many threads at
+// once, each with its own env as under AviSynth+ MT. Every upstream call
+// must see the env of the call it belongs to, and the calls must overlap.
+
+#include <ds_common.hpp>
+#include <avs_wrapper.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+const AVS_Linkage *fake_avs_linkage();
+
+namespace Plugin { const char* Description = "fetch_frame test"; }
+std::vector<register_avsfilter_proc> RegisterAVSFilters() { return {}; }
+
+static constexpr int threads {8};
+static constexpr int frames_per_thread {100};
+static char envs[threads];
+
+static IScriptEnvironment *env_of(int n) {
+  return reinterpret_cast<IScriptEnvironment *>(&envs[n % threads]);
+}
+
+struct CountingClip : IClip {
+  VideoInfo vi {};
+  std::atomic<int> running {0}, most {0}, calls {0}, wrong_env {0};
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment *env) override {
+    if (env != env_of(n))
+      wrong_env++;
+    int now = ++running;
+    for (int seen = most; now > seen && !most.compare_exchange_weak(seen, now);) {}
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    running--;
+    calls++;
+    return PVideoFrame();
+  }
+  bool __stdcall GetParity(int) override { return false; }
+  void __stdcall GetAudio(void *, int64_t, int64_t, IScriptEnvironment *) override {}
+  int __stdcall SetCacheHints(int, int) override { return 0; }
+  const VideoInfo &__stdcall GetVideoInfo() override { return vi; }
+};
+
+int main() {
+  AVS_linkage = fake_avs_linkage();
+  auto clip = new CountingClip;
+  PClip held(clip);
+  AVSInterface::AVSFetchFrameFunctor fetch_frame(held, clip->vi, true);
+
+  int failed = 0;
+  try {
+    fetch_frame(0, DSFrameSet());
+    fprintf(stderr, "fetching without the call's env did not throw\n");
+    failed = 1;
+  }
+  catch (const char *) {}
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++)
+    workers.emplace_back([&, t] {
+      for (int i = 0; i < frames_per_thread; i++) {
+        int n = i * threads + t;
+        DSFrameSet in_frames;
+        in_frames.AVSEnv = env_of(n);
+        DSFrame frame = fetch_frame(n, in_frames);
+        if (frame._env != env_of(n))
+          clip->wrong_env++;
+      }
+    });
+  for (auto &&worker : workers)
+    worker.join();
+
+  if (clip->calls != threads * frames_per_thread) {
+    fprintf(stderr, "%d of %d frames fetched\n", clip->calls.load(), threads * frames_per_thread);
+    failed = 1;
+  }
+  if (clip->wrong_env) {
+    fprintf(stderr, "%d frames fetched with another call's env\n", clip->wrong_env.load());
+    failed = 1;
+  }
+  if (clip->most < 2) {
+    fprintf(stderr, "upstream calls never overlapped\n");
+    failed = 1;
+  }
+  return failed;
+}
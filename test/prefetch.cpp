@@ -0,0 +1,136 @@
+// Requests frames from AVSWrapper one at a time, as a serial host does,
+// with prefetch on. Every frame must be the one requested and the
+// background thread must filter most of them. The filters upstream and the
+// output allocation must only ever be called from the host's thread, and
+// frames filtered in the background must carry no env.
+
+#include <ds_common.hpp>
+#include <avs_wrapper.hpp>
+#include <ds_filter.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+const AVS_Linkage *fake_avs_linkage();
+
+namespace Plugin { const char* Description = "prefetch test"; }
+std::vector<register_avsfilter_proc> RegisterAVSFilters() { return {}; }
+
+// Frames are one byte tokens. An input token holds its frame number, and
+// the filter copies it to its output.
+static constexpr int frames {200};
+struct alignas(16) Token { unsigned char tag; };
+static Token tokens[frames], outputs[frames * 4];
+static std::atomic<int> outputs_used {0};
+static std::thread::id host;
+
+static VideoFrame *token_of(int n) {
+  tokens[n].tag = static_cast<unsigned char>(n);
+  return reinterpret_cast<VideoFrame *>(&tokens[n]);
+}
+
+struct CountingClip : IClip {
+  VideoInfo vi {};
+  std::atomic<int> calls {0}, off_host {0};
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment *) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(300));
+    calls++;
+    if (std::this_thread::get_id() != host)
+      off_host++;
+    return PVideoFrame(token_of(n));
+  }
+  bool __stdcall GetParity(int) override { return false; }
+  void __stdcall GetAudio(void *, int64_t, int64_t, IScriptEnvironment *) override {}
+  int __stdcall SetCacheHints(int, int) override { return 0; }
+  const VideoInfo &__stdcall GetVideoInfo() override { return vi; }
+};
+
+struct Tagging : Filter {
+  std::atomic<int> background {0}, with_env {0};
+  int AVSPrefetch() const override { return 4; }
+  const std::vector<Param> Params() const override { return {}; }
+  DSFrame GetFrame(int n, const DSFrameSet &in_frames) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto &src = in_frames[n];
+    if (std::this_thread::get_id() != host) {
+      background++;
+      if (src._env || in_frames.AVSEnv)
+        with_env++;
+    }
+    // The host's own requests here have no env to allocate with.
+    if (!src._avs_ahead)
+      return src.Clone();
+    auto dst = src.Create(false);
+    dst.DstPointers[0][0] = src.SrcPointers[0][0];
+    return dst;
+  }
+};
+
+struct Wrapper : AVSInterface::AVSWrapper<Tagging> {
+  std::atomic<int> off_host {0};
+  Wrapper() : AVSWrapper(AVSValue(), nullptr) {}
+  PVideoFrame NewFrameAhead(const VideoInfo &, PVideoFrame *, IScriptEnvironment *) override {
+    if (std::this_thread::get_id() != host)
+      off_host++;
+    return PVideoFrame(reinterpret_cast<VideoFrame *>(&outputs[outputs_used++]));
+  }
+};
+
+int main() {
+  AVS_linkage = fake_avs_linkage();
+  host = std::this_thread::get_id();
+  auto clip = new CountingClip;
+  clip->vi.width = clip->vi.height = 16;
+  clip->vi.pixel_type = VideoInfo::CS_Y8;
+  clip->vi.num_frames = frames;
+  PClip held(clip);
+
+  int failed = 0, requests = 0, background = 0;
+  {
+    Wrapper wrapper;
+    wrapper.clip = clip;
+    wrapper.functor = new AVSInterface::AVSFetchFrameFunctor(wrapper.clip, clip->vi, false);
+    wrapper.data.in_vi = DSVideoInfo(clip->vi);
+
+    auto request = [&](int n) {
+      requests++;
+      PVideoFrame frame = wrapper.GetFrame(n, nullptr);
+      const unsigned char *tag = frame ? frame->GetReadPtr() : nullptr;
+      if (!tag || *tag != n) {
+        fprintf(stderr, "request for frame %d got another frame\n", n);
+        failed = 1;
+      }
+      // The encoder's share of the time, which prefetch fills.
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    };
+    for (int n = 0; n < 100; n++)
+      request(n);
+    for (int n : {150, 151, 152, 10, 11, 12, 13, 199})
+      request(n);
+
+    if (wrapper.off_host) {
+      fprintf(stderr, "%d output frames allocated off the host thread\n", wrapper.off_host.load());
+      failed = 1;
+    }
+    if (wrapper.data.with_env) {
+      fprintf(stderr, "%d frames filtered in the background with an env\n", wrapper.data.with_env.load());
+      failed = 1;
+    }
+    background = wrapper.data.background;
+  }
+
+  if (clip->off_host) {
+    fprintf(stderr, "upstream was called %d times off the host thread\n", clip->off_host.load());
+    failed = 1;
+  }
+  if (background < requests / 2) {
+    fprintf(stderr, "only %d of %d requests were filtered in the background\n", background, requests);
+    failed = 1;
+  }
+  if (clip->calls > requests + 3 * 4) {
+    fprintf(stderr, "%d upstream calls for %d requests\n", clip->calls.load(), requests);
+    failed = 1;
+  }
+  return failed;
+}
@@ -0,0 +1,57 @@
+// minideen_process_uv must give the same U and V as filtering the
+// deinterleaved planes one by one, on every kernel.
+
+#include "libminideen.h"
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+template <typename PixelType>
+static int check(int bits, int radius, int opt, int width, int height, int pad) {
+  std::mt19937 rng(width * 131 + height * 7 + radius);
+  int stride = width * 2 + pad;
+  std::vector<PixelType> uv(static_cast<size_t>(stride) * height), out(uv.size());
+  std::vector<PixelType> planes[2], filtered[2];
+  for (int c = 0; c < 2; c++) {
+    planes[c].resize(static_cast<size_t>(width) * height);
+    filtered[c].resize(planes[c].size());
+  }
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width * 2; x++) {
+      // Mostly flat with noise, so some taps pass the threshold and some not.
+      PixelType value = static_cast<PixelType>(((x / 16 + y / 8) * 37 + rng() % 24) & ((1 << bits) - 1));
+      uv[y * stride + x] = value;
+      planes[x & 1][y * width + x / 2] = value;
+    }
+
+  minideen_params params {bits, radius, 20, opt};
+  minideen_context *ctx = minideen_create(&params, nullptr);
+  int bytes = sizeof(PixelType);
+  if (minideen_process_uv(ctx, uv.data(), stride * bytes, out.data(), stride * bytes, width, height) != 0)
+    return 1;
+  for (int c = 0; c < 2; c++)
+    minideen_process_plane(ctx, planes[c].data(), width * bytes, filtered[c].data(), width * bytes, width, height);
+  minideen_free(ctx);
+
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width * 2; x++)
+      if (out[y * stride + x] != filtered[x & 1][y * width + x / 2]) {
+        fprintf(stderr, "%d bit, radius %d, opt %d, %dx%d: mismatch at %d,%d\n", bits, radius, opt, width, height, x, y);
+        return 1;
+      }
+  return 0;
+}
+
+int main() {
+  int failed = 0;
+  const int sizes[][2] {{1, 1}, {7, 5}, {33, 20}, {97, 41}, {160, 90}};
+  for (int opt = 1; opt <= 3; opt++)
+    for (int radius = 1; radius <= 7; radius += 2)
+      for (auto &&size : sizes)
+        for (int pad = 0; pad <= 64; pad += 64) {
+          failed |= check<uint8_t>(8, radius, opt, size[0], size[1], pad);
+          failed |= check<uint16_t>(10, radius, opt, size[0], size[1], pad);
+        }
+  return failed;
+}
@@ -0,0 +1,98 @@
+// minideen_stream must publish output row y as soon as y + radius + 1
+// source rows are pushed, never earlier, in order and once, and give the
+// same plane as minideen_process_plane. Rows not pushed yet hold garbage,
+// so a stream that reads ahead shows up as a mismatch. minideen_process_rows
+// over two halves must give the same plane too.
+
+#include "libminideen.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct Published {
+  int next {0};
+  int pushed {0};
+  int height {0};
+  int radius {0};
+  bool bad {false};
+};
+
+static void on_rows(void *user, int y0, int y1) {
+  auto seen = static_cast<Published *>(user);
+  if (y0 != seen->next || y1 <= y0)
+    seen->bad = true;
+  if (seen->pushed < seen->height && y1 - 1 + seen->radius >= seen->pushed)
+    seen->bad = true;
+  seen->next = y1;
+}
+
+template <typename PixelType>
+static int check(int bits, int radius, int opt, int width, int height, int pad) {
+  std::mt19937 rng(width * 131 + height * 7 + radius);
+  int stride = width + pad;
+  int bytes = sizeof(PixelType);
+  std::vector<PixelType> source(static_cast<size_t>(stride) * height), arriving(source.size());
+  std::vector<PixelType> streamed(source.size()), whole(source.size()), halves(source.size());
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < stride; x++) {
+      source[y * stride + x] = static_cast<PixelType>(((x / 16 + y / 8) * 37 + rng() % 24) & ((1 << bits) - 1));
+      arriving[y * stride + x] = static_cast<PixelType>(rng() & ((1 << bits) - 1));
+    }
+
+  minideen_params params {bits, radius, 20, opt};
+  minideen_context *ctx = minideen_create(&params, nullptr);
+  minideen_process_plane(ctx, source.data(), stride * bytes, whole.data(), stride * bytes, width, height);
+  int split = height / 2;
+  minideen_process_rows(ctx, source.data(), stride * bytes, halves.data(), stride * bytes, width, height, split, height);
+  minideen_process_rows(ctx, source.data(), stride * bytes, halves.data(), stride * bytes, width, height, 0, split);
+
+  Published seen;
+  seen.height = height;
+  seen.radius = radius;
+  minideen_stream *stream = minideen_stream_create(ctx, arriving.data(), stride * bytes, streamed.data(), stride * bytes, width, height, on_rows, &seen);
+  if (!stream)
+    return 1;
+  int failed = 0;
+  for (int rows = 0, step = 1; rows < height; step = step % 7 + 1) {
+    int more = std::min(rows + step, height);
+    memcpy(arriving.data() + static_cast<size_t>(rows) * stride, source.data() + static_cast<size_t>(rows) * stride, static_cast<size_t>(more - rows) * stride * bytes);
+    rows = seen.pushed = more;
+    int done = minideen_stream_push(stream, rows);
+    int expected = rows == height ? height : std::max(rows - radius, 0);
+    if (done != expected || seen.next != expected) {
+      fprintf(stderr, "%d bit, radius %d, opt %d, %dx%d: %d rows pushed, %d published, %d expected\n", bits, radius, opt, width, height, rows, done, expected);
+      failed = 1;
+    }
+  }
+  minideen_stream_free(stream);
+  minideen_free(ctx);
+
+  if (seen.bad) {
+    fprintf(stderr, "%d bit, radius %d, opt %d, %dx%d: rows published early or out of order\n", bits, radius, opt, width, height);
+    failed = 1;
+  }
+  for (int y = 0; y < height && !failed; y++)
+    for (int x = 0; x < width; x++)
+      if (streamed[y * stride + x] != whole[y * stride + x] || halves[y * stride + x] != whole[y * stride + x]) {
+        fprintf(stderr, "%d bit, radius %d, opt %d, %dx%d: mismatch at %d,%d\n", bits, radius, opt, width, height, x, y);
+        failed = 1;
+        break;
+      }
+  return failed;
+}
+
+int main() {
+  int failed = 0;
+  const int sizes[][2] {{1, 1}, {7, 5}, {33, 20}, {97, 41}, {160, 90}};
+  for (int opt = 1; opt <= 3; opt++)
+    for (int radius = 1; radius <= 7; radius += 2)
+      for (auto &&size : sizes)
+        for (int pad = 0; pad <= 64; pad += 64) {
+          failed |= check<uint8_t>(8, radius, opt, size[0], size[1], pad);
+          failed |= check<uint16_t>(10, radius, opt, size[0], size[1], pad);
+        }
+  return failed;
+}